@@ -0,0 +1,194 @@
+#include "EMG_Codec.h"
+
+void Pack10_Pack4(const uint16_t* samples, uint8_t* packed) {
+	packed[0] = (uint8_t)samples[0];
+	packed[1] = (uint8_t)samples[1];
+	packed[2] = (uint8_t)samples[2];
+	packed[3] = (uint8_t)samples[3];
+	packed[4] = ((samples[0] >> 8) & 0x03)
+	          | ((samples[1] >> 6) & 0x0C)
+	          | ((samples[2] >> 4) & 0x30)
+	          | ((samples[3] >> 2) & 0xC0);
+}
+
+void Pack10_Unpack4(const uint8_t* packed, uint16_t* samples) {
+	uint8_t high = packed[4];
+	samples[0] = packed[0] | ((uint16_t)(high & 0x03) << 8);
+	samples[1] = packed[1] | ((uint16_t)(high & 0x0C) << 6);
+	samples[2] = packed[2] | ((uint16_t)(high & 0x30) << 4);
+	samples[3] = packed[3] | ((uint16_t)(high & 0xC0) << 2);
+}
+
+uint16_t Pack10_Get(const uint8_t* packed, uint16_t index) {
+	const uint8_t* group = packed + (index / PACK10_GROUP_SAMPLES) * PACK10_GROUP_BYTES;
+	uint8_t lane = index % PACK10_GROUP_SAMPLES;
+	return group[lane] | ((uint16_t)((group[4] >> (2 * lane)) & 0x03) << 8);
+}
+
+// Bit writer for the Rice coder, MSB first
+typedef struct {
+	uint8_t* out;		// NULL: only count bits
+	uint16_t pos;
+	uint8_t  acc;
+	uint8_t  used;
+	uint16_t bits;
+} BitWriter;
+
+static void put_bit(BitWriter* w, uint8_t bit) {
+	w->bits++;
+	if (!w->out) return;
+	w->acc = (w->acc << 1) | bit;
+	if (++w->used == 8) {
+		w->out[w->pos++] = w->acc;
+		w->acc = 0;
+		w->used = 0;
+	}
+}
+
+static void put_bits(BitWriter* w, uint16_t value, uint8_t count) {
+	while (count--) {
+		put_bit(w, (value >> count) & 1);
+	}
+}
+
+static uint16_t zigzag(int16_t delta) {
+	return ((uint16_t)delta << 1) ^ (uint16_t)(delta >> 15);	// 0, -1, 1, -2, 2 ... -> 0, 1, 2, 3, 4 ...
+}
+
+// Runs the coder over the block. With w->out == NULL it only counts the bits.
+// Stops early once 'limit' bits are exceeded, which bounds the time spent on noisy blocks.
+static void rice_pass(const uint8_t* packed, uint16_t count, uint8_t k, BitWriter* w, uint16_t limit) {
+	uint16_t samples[PACK10_GROUP_SAMPLES];
+	uint16_t prev = 0;
+	
+	for (uint16_t g = 0; g < PACK10_BYTES(count); g += PACK10_GROUP_BYTES) {
+		Pack10_Unpack4(&packed[g], samples);
+		for (uint8_t i = 0; i < PACK10_GROUP_SAMPLES; i++) {
+			if (g == 0 && i == 0) {
+				put_bits(w, samples[0], 10);
+			} else {
+				uint16_t zz = zigzag((int16_t)(samples[i] - prev));
+				uint16_t q = zz >> k;
+				if (w->bits + q + 1 + k > limit) {
+					w->bits = limit + 1;
+					return;
+				}
+				while (q--) put_bit(w, 1);
+				put_bit(w, 0);
+				put_bits(w, zz, k);
+			}
+			prev = samples[i];
+		}
+	}
+	if (w->out && w->used) {
+		w->out[w->pos++] = w->acc << (8 - w->used);		// Pad the last byte
+	}
+}
+
+uint16_t Rice_EncodeBlock(const uint8_t* packed, uint16_t count, uint8_t* block) {
+	uint16_t stored = PACK10_BYTES(count);
+	uint16_t samples[PACK10_GROUP_SAMPLES];
+	uint16_t prev = 0;
+	uint32_t sum = 0;
+	uint8_t k = 0;
+	
+	// 1. Mean size of the zigzag deltas gives the Rice parameter (2^k ~ mean)
+	for (uint16_t g = 0; g < stored; g += PACK10_GROUP_BYTES) {
+		Pack10_Unpack4(&packed[g], samples);
+		for (uint8_t i = 0; i < PACK10_GROUP_SAMPLES; i++) {
+			if (g || i) sum += zigzag((int16_t)(samples[i] - prev));
+			prev = samples[i];
+		}
+	}
+	while (k < RICE_MAX_K && ((uint32_t)count << (k + 1)) <= sum) {
+		k++;
+	}
+	
+	// 2. Count the coded size, 3. code the block if it is smaller than the stored samples
+	BitWriter w = { 0 };
+	rice_pass(packed, count, k, &w, stored * 8);
+	
+	uint16_t size;
+	if (w.bits <= stored * 8) {
+		w = (BitWriter){ .out = &block[RICE_BLOCK_HEADER] };
+		rice_pass(packed, count, k, &w, stored * 8);
+		size = w.pos;
+	} else {
+		k = RICE_STORED;
+		for (uint16_t i = 0; i < stored; i++) {
+			block[RICE_BLOCK_HEADER + i] = packed[i];
+		}
+		size = stored;
+	}
+	block[0] = k;
+	block[1] = (uint8_t)size;
+	block[2] = size >> 8;
+	return RICE_BLOCK_HEADER + size;
+}
+
+// Bit reader for the Rice decoder, MSB first. Reads past the end return 0-bits and set 'overrun'.
+typedef struct {
+	const uint8_t* in;
+	uint16_t pos;
+	uint16_t end;		// Payload size in bits
+	uint8_t  overrun;
+} BitReader;
+
+static uint8_t get_bit(BitReader* r) {
+	if (r->pos >= r->end) {
+		r->overrun = 1;
+		return 0;
+	}
+	uint8_t bit = (r->in[r->pos >> 3] >> (7 - (r->pos & 7))) & 1;
+	r->pos++;
+	return bit;
+}
+
+static uint16_t get_bits(BitReader* r, uint8_t count) {
+	uint16_t value = 0;
+	while (count--) {
+		value = (value << 1) | get_bit(r);
+	}
+	return value;
+}
+
+uint8_t Rice_DecodeBlock(const uint8_t* block, uint16_t count, uint8_t* packed) {
+	uint16_t stored = PACK10_BYTES(count);
+	uint8_t  k      = block[0];
+	uint16_t size   = block[1] | ((uint16_t)block[2] << 8);
+	const uint8_t* payload = &block[RICE_BLOCK_HEADER];
+	
+	if (k == RICE_STORED) {
+		if (size != stored) return 1;
+		for (uint16_t i = 0; i < stored; i++) {
+			packed[i] = payload[i];
+		}
+		return 0;
+	}
+	if (k > RICE_MAX_K || size > stored) return 1;
+	
+	BitReader r = { .in = payload, .end = size * 8 };
+	uint16_t samples[PACK10_GROUP_SAMPLES];
+	uint16_t prev = 0;
+	
+	for (uint16_t g = 0; g < stored; g += PACK10_GROUP_BYTES) {
+		for (uint8_t i = 0; i < PACK10_GROUP_SAMPLES; i++) {
+			if (g == 0 && i == 0) {
+				samples[0] = get_bits(&r, 10);
+			} else {
+				uint16_t q = 0;
+				while (get_bit(&r)) {
+					if (++q > (2047 >> k)) return 1;	// Larger than any 10-bit delta
+				}
+				uint16_t zz = (q << k) | get_bits(&r, k);
+				int16_t delta = (int16_t)(zz >> 1) ^ -(int16_t)(zz & 1);
+				samples[i] = prev + delta;
+				if (samples[i] > 1023) return 1;
+			}
+			prev = samples[i];
+		}
+		if (r.overrun) return 1;
+		Pack10_Pack4(samples, &packed[g]);
+	}
+	return 0;
+}
@@ -0,0 +1,50 @@
+#ifndef EMG_CODEC_H_
+#define EMG_CODEC_H_
+
+#include <stdint.h>
+
+// ========== Packed 10-bit samples ==========
+// The ADC gives 10-bit samples. Four samples are packed into five bytes:
+//   byte 0-3: low 8 bits of sample 0-3
+//   byte 4:   high 2 bits of sample 0 (bit 1-0), sample 1 (bit 3-2), sample 2 (bit 5-4), sample 3 (bit 7-6)
+// The same layout is used for the sample buffers in RAM and for EMG_LOG_RECORD_RAW10 in log files,
+// so a full window can be written to the SD card without conversion.
+
+#define PACK10_GROUP_SAMPLES  4
+#define PACK10_GROUP_BYTES    5
+#define PACK10_BYTES(samples) ((samples) / PACK10_GROUP_SAMPLES * PACK10_GROUP_BYTES)	// 'samples' must be a multiple of 4
+
+// Packs 4 samples (0-1023) into 5 bytes
+void Pack10_Pack4(const uint16_t* samples, uint8_t* packed);
+
+// Unpacks 5 bytes into 4 samples
+void Pack10_Unpack4(const uint8_t* packed, uint16_t* samples);
+
+// Reads sample number 'index' from a packed buffer
+uint16_t Pack10_Get(const uint8_t* packed, uint16_t index);
+
+// ========== Delta + Rice block coding ==========
+// One window of samples is coded as one block:
+//   byte 0:   Rice parameter k (0-10), or RICE_STORED for an uncoded block
+//   byte 1-2: payload size in bytes (little-endian)
+//   payload:  k <= 10: first sample as 10 bits, then the zigzag coded delta to the previous sample
+//                      for each following sample as a Rice code (q = zz >> k one-bits, a zero-bit,
+//                      then the k low bits). MSB first, the last byte is padded with zero-bits.
+//             RICE_STORED: the packed 10-bit samples, unchanged
+// k is picked from the mean delta of the block. If the coded block would be larger than the
+// packed samples, the block is stored instead, so a block never exceeds RICE_BLOCK_MAX_BYTES
+// and the encoder never emits more than 8 * PACK10_BYTES(count) payload bits.
+
+#define RICE_STORED          0xFF
+#define RICE_BLOCK_HEADER    3
+#define RICE_MAX_K           10
+#define RICE_BLOCK_MAX_BYTES(samples) (RICE_BLOCK_HEADER + PACK10_BYTES(samples))
+
+// Codes 'count' packed samples (multiple of 4) into 'block'. Returns the block size in bytes.
+uint16_t Rice_EncodeBlock(const uint8_t* packed, uint16_t count, uint8_t* block);
+
+// Decodes a block from Rice_EncodeBlock() back into 'count' packed samples.
+// Returns 0 on success, 1 if the block is corrupt (bad header, payload too short, sample out of range).
+uint8_t Rice_DecodeBlock(const uint8_t* block, uint16_t count, uint8_t* packed);
+
+#endif /* EMG_CODEC_H_ */
@@ -0,0 +1,371 @@
+#include <string.h>
+#include "Logger.h"
+#include "SD_Driver.h"
+#include "Timer_Driver.h"
+#include "EMG_Codec.h"
+
+static FIL log_file;							// Open log file
+static uint8_t  sector_buf[2][LOGGER_SECTOR_SIZE];	// Contiguous mode: one sector is filled while the other is sent in the background
+static uint8_t* staging = sector_buf[0];		// Records waiting to be written (one sector)
+static uint8_t* pending = 0;					// Contiguous mode: full sector waiting for the card to finish the previous one
+static uint16_t staged = 0;						// Bytes used in staging[]
+static uint8_t  sectors_since_sync = 0;			// Whole sectors written since last f_sync()
+
+// Contiguous mode (see Logger.h)
+static uint8_t  contiguous = 0;					// 1 = sectors are streamed to the preallocated area
+static LBA_t    next_lba;						// Next sector to write
+static LBA_t    end_lba;						// First sector after the preallocated area
+static uint32_t bytes_logged;					// File size so far (whole sectors written)
+static volatile uint8_t write_failed;			// Set from the SPI interrupt when the card rejected a sector
+
+// Next segment (Logger_PrepareNext)
+static FIL      next_file;						// Created and preallocated in advance
+static char     next_name[13];					// Its 8.3 file name
+static uint8_t  next_open = 0;					// 1 = next_file is open
+static uint8_t  next_contiguous;				// 1 = next_file has a contiguous area starting at next_first_lba
+static LBA_t    next_first_lba;
+
+// Previous segment (Logger_StopSegment): truncated and closed by Logger_Service() once the new one is streaming
+static FIL      old_file;
+static uint8_t  old_open = 0;					// 1 = old_file still has to be truncated and closed
+static uint32_t old_size;						// Its real size (bytes logged)
+
+static LoggerStats stats;						// Statistics of the current session
+static uint32_t    start_ms;					// Timer_Millis() at Logger_Start()
+static uint32_t    rms_count;					// RMS values in rms_sum
+static uint64_t    rms_sum;						// Sum of all RMS values (for stats.rms_mean)
+static uint16_t    write_us_rest;				// Sector write time not yet counted in stats.write_total_ms
+
+// Preallocates a contiguous area for the open 'file' and finds its first sector.
+// Returns FR_OK if the file can be streamed to directly.
+static FRESULT preallocate(FIL* file, LBA_t* first_lba) {
+	FRESULT res;
+	FATFS* fs = file->obj.fs;
+	
+	res = f_expand(file, LOGGER_PREALLOC_BYTES, 1);		// Find and allocate contiguous clusters
+	if (res != FR_OK) return res;
+	
+	res = f_sync(file);									// Directory entry points at the area even after a crash
+	if (res != FR_OK) return res;
+	
+	*first_lba = fs->database + (LBA_t)(file->obj.sclust - 2) * fs->csize;
+	return FR_OK;
+}
+
+// Completion callback of background sector writes (runs in the SPI interrupt)
+static void sector_written(uint8_t status) {
+	if (status) write_failed = 1;
+}
+
+// Sends the pending sector to the next sector of the contiguous area in the background.
+// Waits for the card if it is still busy with the previous sector.
+static FRESULT send_pending(void) {
+	if (!pending) return FR_OK;
+	if (write_failed) return FR_DISK_ERR;		// Previous sector was rejected by the card
+	if (SD_stream_write_async(next_lba, pending, sector_written) != 0) return FR_DISK_ERR;
+	next_lba++;
+	bytes_logged += LOGGER_SECTOR_SIZE;
+	pending = 0;
+	return FR_OK;
+}
+
+// Writes the full staging buffer as one sector.
+// Contiguous mode hands it over as the pending sector and switches to the other buffer. The sector is sent at once
+// if the card is ready, otherwise Logger_Service() sends it when the card has finished programming the previous one.
+// f_write() mode syncs every LOGGER_SYNC_INTERVAL sectors.
+static FRESULT write_sector(void) {
+	UINT bw;
+	FRESULT res;
+	
+	if (contiguous) {
+		if (next_lba + (pending ? 1 : 0) >= end_lba) return FR_DENIED;	// Preallocated area is full (staging is kept)
+		res = send_pending();						// Both buffers full: only now the card is waited for
+		if (res != FR_OK) return res;
+		if (SD_async_wait() != 0) return FR_DISK_ERR;	// Other buffer may still be on its way to the card (data phase only)
+		pending = staging;
+		staging = (staging == sector_buf[0]) ? sector_buf[1] : sector_buf[0];
+		staged = 0;
+		if (!SD_poll_busy()) return send_pending();
+		return FR_OK;
+	}
+	
+	res = f_write(&log_file, staging, LOGGER_SECTOR_SIZE, &bw);		// File offset is sector aligned => FatFs writes straight to disk
+	if (res == FR_OK && bw != LOGGER_SECTOR_SIZE) res = FR_DISK_ERR;
+	staged = 0;
+	
+	if (res == FR_OK && LOGGER_SYNC_INTERVAL && ++sectors_since_sync >= LOGGER_SYNC_INTERVAL) {
+		sectors_since_sync = 0;
+		res = f_sync(&log_file);
+	}
+	return res;
+}
+
+// Adds 'us' spent writing a sector to the latency statistics
+static void note_write_time(uint32_t us) {
+	if (us > stats.write_max_us) stats.write_max_us = us;
+	us += write_us_rest;
+	stats.write_total_ms += us / 1000;
+	write_us_rest = us % 1000;
+}
+
+// write_sector() with latency statistics
+static FRESULT flush_sector(void) {
+	uint32_t t0 = Timer_Micros();
+	FRESULT res = write_sector();
+	
+	if (res == FR_OK) stats.sectors++;
+	note_write_time(Timer_Micros() - t0);
+	return res;
+}
+
+// Copies 'len' bytes into the staging buffer, writing each sector as it fills up
+static FRESULT append(const uint8_t* data, uint16_t len) {
+	FRESULT res = FR_OK;
+	
+	stats.bytes += len;
+	while (len) {
+		uint16_t chunk = LOGGER_SECTOR_SIZE - staged;
+		if (chunk > len) chunk = len;
+		
+		memcpy(&staging[staged], data, chunk);
+		staged += chunk;
+		data   += chunk;
+		len    -= chunk;
+		
+		if (staged == LOGGER_SECTOR_SIZE) {
+			res = flush_sector();
+			if (res != FR_OK) break;
+		}
+	}
+	return res;
+}
+
+// Gives the unused part of the preallocated area back to the file system and closes the file.
+// Also after a write error: otherwise the file keeps its full preallocated size with stale data behind the records
+static FRESULT truncate_close(FIL* file, uint32_t size) {
+	FRESULT res = f_lseek(file, size);
+	if (res == FR_OK) res = f_truncate(file);
+	FRESULT close_res = f_close(file);
+	return (res != FR_OK) ? res : close_res;
+}
+
+// Finishes the file of the previous segment (Logger_StopSegment).
+// A failure is not an error of the running segment: the old file then keeps its preallocated size.
+static void finish_old(void) {
+	if (!old_open) return;
+	old_open = 0;
+	truncate_close(&old_file, old_size);
+}
+
+FRESULT Logger_Start(const char* filename, uint8_t record_type, const LoggerConfig* config) {
+	EmgLogHeader header;
+	FRESULT res;
+	
+	staged = 0;
+	staging = sector_buf[0];
+	pending = 0;
+	sectors_since_sync = 0;
+	bytes_logged = 0;
+	write_failed = 0;
+	memset(&stats, 0, sizeof(stats));
+	stats.rms_min = 0xFFFF;
+	rms_count = 0;
+	rms_sum = 0;
+	write_us_rest = 0;
+	start_ms = Timer_Millis();
+	
+	if (next_open && strcmp(filename, next_name) == 0) {
+		log_file   = next_file;				// Created in advance: nothing to allocate now
+		contiguous = next_contiguous;
+		next_lba   = next_first_lba;
+		next_open  = 0;
+	} else {
+		Logger_CancelNext();
+		res = f_open(&log_file, filename, FA_WRITE | FA_CREATE_ALWAYS);
+		if (res != FR_OK) {
+			finish_old();		// No new segment: Logger_Stop() will not be called
+			return res;
+		}
+		
+		contiguous = (preallocate(&log_file, &next_lba) == FR_OK);	// Falls back to f_write() if no contiguous area was found
+	}
+	
+	if (contiguous) {
+		end_lba = next_lba + LOGGER_PREALLOC_BYTES / LOGGER_SECTOR_SIZE;
+		
+		// Tell the driver the whole area will be written in order, so the card can pre-erase it (ACMD23)
+		LBA_t extent[2] = { next_lba, end_lba - 1 };
+		disk_ioctl(log_file.obj.fs->pdrv, MMC_SET_WRITE_EXTENT, extent);
+	}
+	
+	memcpy(header.magic, EMG_LOG_MAGIC, 4);
+	header.version     = EMG_LOG_VERSION;
+	header.header_size = sizeof(EmgLogHeader);
+	header.record_type = record_type;
+	header.reserved    = 0;
+	header.config      = *config;	// AVR is little-endian, so the struct is already in file byte order
+	header.start_time  = get_fattime();
+	
+	return append((const uint8_t*)&header, sizeof(header));
+}
+
+FRESULT Logger_PrepareNext(const char* filename) {
+	FRESULT res;
+	
+	if (next_open) return FR_OK;
+	
+	res = f_open(&next_file, filename, FA_WRITE | FA_CREATE_ALWAYS);	// Ends the running stream; the next sector reopens it
+	if (res != FR_OK) return res;
+	
+	strncpy(next_name, filename, sizeof(next_name) - 1);
+	next_name[sizeof(next_name) - 1] = '\0';
+	next_contiguous = (preallocate(&next_file, &next_first_lba) == FR_OK);
+	next_open = 1;
+	return FR_OK;
+}
+
+uint8_t Logger_NextPrepared(void) {
+	return next_open;
+}
+
+void Logger_CancelNext(void) {
+	if (!next_open) return;
+	
+	next_open = 0;
+	f_close(&next_file);
+	f_unlink(next_name);		// Frees the preallocated clusters again
+}
+
+void Logger_FinishPrevious(void) {
+	finish_old();
+}
+
+FRESULT Logger_Service(void) {
+	// Previous segment: only after the first sector of the new one is on its way, so the switch itself stays short
+	if (old_open && stats.sectors && !pending) finish_old();
+	
+	if (!pending || SD_poll_busy()) return FR_OK;
+	
+	uint32_t t0 = Timer_Micros();
+	FRESULT res = send_pending();
+	note_write_time(Timer_Micros() - t0);
+	return res;
+}
+
+uint32_t Logger_BytesFree(void) {
+	uint32_t used = stats.bytes + sizeof(EmgLogTrailer);
+	return (used < LOGGER_SEGMENT_BYTES) ? LOGGER_SEGMENT_BYTES - used : 0;
+}
+
+void Logger_NoteRms(uint16_t rms_mv) {
+	if (rms_mv < stats.rms_min) stats.rms_min = rms_mv;
+	if (rms_mv > stats.rms_max) stats.rms_max = rms_mv;
+	rms_sum += rms_mv;
+	rms_count++;
+}
+
+FRESULT Logger_WriteThreshold(uint16_t threshold_mv) {
+	uint8_t record[6];
+	uint32_t mark = EMG_LOG_THRESHOLD_MARK;
+	
+	memcpy(record, &mark, 4);
+	record[4] = (uint8_t)threshold_mv;
+	record[5] = (uint8_t)(threshold_mv >> 8);
+	return append(record, sizeof(record));
+}
+
+FRESULT Logger_WriteRms(uint32_t t_ms, uint16_t rms_mv) {
+	uint8_t record[6];
+	
+	Logger_NoteRms(rms_mv);
+	
+	memcpy(record, &t_ms, 4);		// AVR is little-endian, same as the file
+	record[4] = (uint8_t)rms_mv;
+	record[5] = (uint8_t)(rms_mv >> 8);
+	
+	stats.windows++;
+	return append(record, sizeof(record));
+}
+
+FRESULT Logger_WriteRaw10(uint32_t t_ms, const uint8_t* packed, uint16_t count) {
+	return Logger_WriteBlock(t_ms, packed, PACK10_BYTES(count), count);
+}
+
+FRESULT Logger_WriteBlock(uint32_t t_ms, const uint8_t* block, uint16_t bytes, uint16_t count) {
+	stats.windows++;
+	stats.samples += count;
+	
+	FRESULT res = append((const uint8_t*)&t_ms, sizeof(t_ms));
+	if (res != FR_OK) return res;
+	return append(block, bytes);
+}
+
+void Logger_GetStats(LoggerStats* out) {
+	*out = stats;
+	if (rms_count) {
+		out->rms_mean = rms_sum / rms_count;
+	} else {
+		out->rms_min = 0;		// No windows yet
+	}
+}
+
+// Logger_Stop() and Logger_StopSegment(). With 'defer' set a contiguous file is left open untruncated in old_file.
+static FRESULT stop(uint32_t dropped_windows, uint8_t defer) {
+	EmgLogTrailer trailer;
+	UINT bw;
+	FRESULT res = FR_OK;
+	
+	finish_old();				// Session ended before the previous segment was finished
+	
+	stats.dropped_windows = dropped_windows;
+	stats.duration_ms     = Timer_Millis() - start_ms;
+	
+	memcpy(trailer.magic, EMG_LOG_TRAILER_MAGIC, 4);
+	Logger_GetStats(&trailer.stats);
+	trailer.stats.bytes += sizeof(trailer);		// Final file size includes the trailer itself
+	FRESULT trailer_res = append((const uint8_t*)&trailer, sizeof(trailer));
+	
+	if (contiguous) {
+		if (send_pending() != FR_OK) res = FR_DISK_ERR;
+		
+		// Last, partly filled sector is padded; the file is truncated to the real size below
+		if (staged && next_lba < end_lba) {
+			memset(&staging[staged], 0, LOGGER_SECTOR_SIZE - staged);
+			if (SD_stream_write(next_lba, staging) == 0) bytes_logged += staged;
+			else res = FR_DISK_ERR;
+		}
+		staged = 0;
+		SD_stream_end();							// Also waits for the background write
+		disk_ioctl(log_file.obj.fs->pdrv, MMC_SET_WRITE_EXTENT, 0);
+		if (write_failed) res = FR_DISK_ERR;
+		contiguous = 0;
+		
+		if (defer) {
+			old_file = log_file;
+			old_size = bytes_logged;
+			old_open = 1;
+			return (res != FR_OK) ? res : trailer_res;
+		}
+		FRESULT trunc_res = truncate_close(&log_file, bytes_logged);
+		if (res != FR_OK) return res;
+		if (trailer_res != FR_OK) return trailer_res;
+		return trunc_res;
+	}
+	if (staged) {
+		res = f_write(&log_file, staging, staged, &bw);	// Last, partly filled sector
+		staged = 0;
+	}
+	FRESULT close_res = f_close(&log_file);
+	
+	if (res != FR_OK) return res;
+	if (trailer_res != FR_OK) return trailer_res;
+	return close_res;
+}
+
+FRESULT Logger_Stop(uint32_t dropped_windows) {
+	return stop(dropped_windows, 0);
+}
+
+FRESULT Logger_StopSegment(uint32_t dropped_windows) {
+	return stop(dropped_windows, 1);
+}
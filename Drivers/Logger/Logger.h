@@ -0,0 +1,147 @@
+#ifndef LOGGER_H_
+#define LOGGER_H_
+
+#include <stdint.h>
+#include "ff.h"
+
+// ========== EMG log file format ==========
+// A log file is a header (EmgLogHeader), records (fixed-size, or one variable-size block per window
+// for EMG_LOG_RECORD_RICE) and a trailer (EmgLogTrailer) with session statistics.
+// Since version 3 every record starts with a uint32_t timestamp: Timer_Millis() when the last sample of the
+// window was converted. Consecutive windows are window_size / sample_rate_hz apart, so dropped windows show as gaps.
+// Since version 5 a threshold change is logged as its own record between two windows: the timestamp
+// EMG_LOG_THRESHOLD_MARK followed by the uint16_t new threshold (mV scaled by rms_scale, as threshold_mv).
+// It applies to the windows after it, so a replay takes the same decisions as the recording.
+// All multi-byte fields are little-endian. Tools/emg_log_decode.py decodes the files on a PC.
+
+#define EMG_LOG_MAGIC          "EMGL"
+#define EMG_LOG_TRAILER_MAGIC  "EMGT"
+#define EMG_LOG_VERSION        5
+#define EMG_LOG_THRESHOLD_MARK 0xFFFFFFFEUL	// Timestamp of a threshold record (version 5+)
+
+// Record types (EmgLogHeader.record_type)
+#define EMG_LOG_RECORD_RMS  1	// Timestamp + uint16_t RMS value in mV (scaled by rms_scale) per window
+#define EMG_LOG_RECORD_RAW  2	// uint16_t raw ADC sample (0-1023), window_size samples per window (written and decoded through version 2, superseded by RAW10/RICE from version 3)
+#define EMG_LOG_RECORD_RAW10 3	// Raw ADC samples packed 4 per 5 bytes (EMG_Codec.h), window_size samples per window
+#define EMG_LOG_RECORD_RICE 4	// Raw ADC samples, one delta/Rice coded block (EMG_Codec.h) per window
+
+// Acquisition parameters stored in the file header
+typedef struct {
+	uint16_t sample_rate_hz;	// ADC sample rate
+	uint16_t window_size;		// Samples per RMS window (BUFFER_SIZE)
+	uint16_t vref_mv;			// ADC reference voltage (VREF)
+	uint16_t threshold_mv;		// Activation threshold when the session started (changes: threshold records)
+	uint16_t rms_scale;			// Logged RMS values are multiplied by this factor
+} LoggerConfig;
+
+// File header (22 bytes, struct is packed by -fpack-struct)
+typedef struct {
+	char     magic[4];			// EMG_LOG_MAGIC
+	uint8_t  version;			// EMG_LOG_VERSION
+	uint8_t  header_size;		// sizeof(EmgLogHeader), records start at this offset
+	uint8_t  record_type;		// EMG_LOG_RECORD_xxx
+	uint8_t  reserved;
+	LoggerConfig config;
+	uint32_t start_time;		// Session start in FAT date/time format (get_fattime), version 4+
+} EmgLogHeader;
+
+// Session statistics
+typedef struct {
+	uint32_t windows;			// Windows logged
+	uint32_t samples;			// Raw samples logged (0 in RMS mode)
+	uint32_t dropped_windows;	// Windows lost because the main loop fell behind the ADC
+	uint32_t duration_ms;		// Time from Logger_Start() to Logger_Stop()
+	uint32_t bytes;				// Bytes logged (header, records and trailer)
+	// Version 4+
+	uint16_t rms_min;			// Smallest, largest and mean RMS of all windows (mV scaled by rms_scale, as in RMS records)
+	uint16_t rms_max;
+	uint16_t rms_mean;
+	uint32_t sectors;			// Sectors written
+	uint32_t write_max_us;		// Longest sector write (includes waiting for the previous background write)
+	uint32_t write_total_ms;	// Time spent writing sectors (mean latency = write_total_ms * 1000 / sectors)
+} LoggerStats;
+
+// File trailer (42 bytes), last bytes of the file
+typedef struct {
+	char        magic[4];		// EMG_LOG_TRAILER_MAGIC
+	LoggerStats stats;
+} EmgLogTrailer;
+
+// ========== Configuration ==========
+// Records are collected in a 512-byte staging buffer and written one whole sector at a time.
+//
+// Contiguous mode (default): Logger_Start() preallocates LOGGER_PREALLOC_BYTES of contiguous clusters
+// with f_expand() and full sectors are streamed straight to that LBA range with one open CMD25,
+// bypassing FatFs and the FAT. The area is announced to the driver (MMC_SET_WRITE_EXTENT), which pre-erases
+// it with ACMD23 when the stream starts. Each sector is sent in the background (SD_stream_write_async) while
+// records are collected in a second staging buffer. While the card is still busy programming the previous sector,
+// a full sector is kept pending and Logger_Service() sends it from the main loop, so the caller only waits for
+// the card when both buffers are full. Logger_Stop() truncates the file to the bytes actually logged.
+// If the card has no contiguous free area of that size, the logger falls back to f_write().
+//
+// f_write() mode: f_sync() runs after every LOGGER_SYNC_INTERVAL sectors (0 = only when the log is stopped).
+// A crash loses at most the staging buffer plus LOGGER_SYNC_INTERVAL sectors.
+//
+// Rolling files: a recording is split into segment files of at most LOGGER_SEGMENT_BYTES (in both modes).
+// The caller watches Logger_BytesFree() and switches files with Logger_Stop() + Logger_Start(). The next file
+// can be created and preallocated in advance with Logger_PrepareNext(), so the switch only writes the header.
+#define LOGGER_SECTOR_SIZE     512
+#define LOGGER_SYNC_INTERVAL   8
+#define LOGGER_PREALLOC_BYTES  (16UL * 1024UL * 1024UL)
+#define LOGGER_SEGMENT_BYTES   LOGGER_PREALLOC_BYTES
+
+// ========== Function Prototypes ==========
+
+// Creates 'filename' (overwrites if it exists) and writes the header. Returns FR_OK on success.
+// If 'filename' was prepared with Logger_PrepareNext(), the prepared file is used.
+FRESULT Logger_Start(const char* filename, uint8_t record_type, const LoggerConfig* config);
+
+// Creates and preallocates the file of the next segment while the current one is still being written
+FRESULT Logger_PrepareNext(const char* filename);
+
+// 1 if a file prepared by Logger_PrepareNext() is waiting to be started
+uint8_t Logger_NextPrepared(void);
+
+// Closes and deletes a prepared file that will not be used (end of the recording)
+void Logger_CancelNext(void);
+
+// Sends a pending sector once the card is no longer busy, and finishes the file of the previous segment
+// (Logger_StopSegment). Call it often (main loop) while a session is open.
+FRESULT Logger_Service(void);
+
+// Bytes that can still be appended before the segment is full (room for the trailer is kept)
+uint32_t Logger_BytesFree(void);
+
+// Appends a threshold record: the windows after it were decided with 'threshold_mv'
+FRESULT Logger_WriteThreshold(uint16_t threshold_mv);
+
+// Appends one RMS record (mV) of the window that ended at 't_ms'. Returns FR_DENIED when the preallocated area is full.
+FRESULT Logger_WriteRms(uint32_t t_ms, uint16_t rms_mv);
+
+// Adds the RMS (mV) of a window to the session statistics without writing a record (raw sample logging)
+void Logger_NoteRms(uint16_t rms_mv);
+
+// Appends one window of packed 10-bit samples ('count' samples, PACK10_BYTES(count) bytes) that ended at 't_ms'.
+// Returns FR_DENIED when the preallocated area is full.
+FRESULT Logger_WriteRaw10(uint32_t t_ms, const uint8_t* packed, uint16_t count);
+
+// Appends one coded window ('bytes' bytes holding 'count' samples, e.g. from Rice_EncodeBlock()) that ended at 't_ms'.
+// Returns FR_DENIED when the preallocated area is full.
+FRESULT Logger_WriteBlock(uint32_t t_ms, const uint8_t* block, uint16_t bytes, uint16_t count);
+
+// Writes the trailer and the partly filled staging buffer, sets the final file size and closes the log file
+FRESULT Logger_Stop(uint32_t dropped_windows);
+
+// As Logger_Stop(), when the next segment is started right after it. In contiguous mode the truncation and
+// f_close() are left to Logger_Service(), which runs them once the next segment has written its first sector.
+FRESULT Logger_StopSegment(uint32_t dropped_windows);
+
+// Truncates and closes the file of the previous segment now, if Logger_StopSegment() left one open.
+// Call it on every path where the next segment is not started, and before the volume is mounted again
+// (the open file belongs to the old mount).
+void Logger_FinishPrevious(void);
+
+// Statistics of the running (or last stopped) session
+void Logger_GetStats(LoggerStats* stats);
+
+#endif /* LOGGER_H_ */
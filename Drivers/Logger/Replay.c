@@ -0,0 +1,107 @@
+#include <string.h>
+#include "Replay.h"
+#include "EMG_Codec.h"
+
+#define REPLAY_TRAILER_V3_BYTES 24		// Trailer before version 4 (stats without RMS and write latency)
+#define REPLAY_MAX_GAP_MS       60000UL	// Larger steps between windows are not records (erased sectors read as 0xFF)
+
+static FIL      replay_file;					// Replayed log file
+static uint8_t  record_type;					// EMG_LOG_RECORD_xxx of the file
+static uint16_t window_size;					// Samples per window
+static FSIZE_t  records_end;					// File offset where the records end (trailer or end of file)
+static uint32_t last_ms;						// Timestamp of the previous window
+static uint8_t  first;							// 1 = no window read yet
+static uint8_t  threshold_records;				// 1 = file can have threshold records (version 5+)
+static uint32_t threshold_max;					// Largest valid threshold (full-scale RMS)
+
+// Reads exactly 'len' bytes below records_end. Returns 1 on success.
+static uint8_t read_exact(void* buf, UINT len) {
+	UINT br;
+	if (f_tell(&replay_file) + len > records_end) return 0;
+	return f_read(&replay_file, buf, len, &br) == FR_OK && br == len;
+}
+
+FRESULT Replay_Open(const char* filename, EmgLogHeader* header) {
+	FRESULT res;
+	UINT br;
+	char magic[4];
+	
+	res = f_open(&replay_file, filename, FA_READ);
+	if (res != FR_OK) return res;
+	
+	res = f_read(&replay_file, header, sizeof(EmgLogHeader), &br);
+	if (res == FR_OK && (br != sizeof(EmgLogHeader)
+	                     || memcmp(header->magic, EMG_LOG_MAGIC, 4) != 0
+	                     || header->version < 3 || header->version > EMG_LOG_VERSION
+	                     || header->config.window_size % PACK10_GROUP_SAMPLES != 0
+	                     || (header->record_type != EMG_LOG_RECORD_RMS && header->record_type != EMG_LOG_RECORD_RAW10
+	                         && header->record_type != EMG_LOG_RECORD_RICE))) {
+		res = FR_INVALID_OBJECT;
+	}
+	if (res != FR_OK) {
+		f_close(&replay_file);
+		return res;
+	}
+	if (header->version < 4) header->start_time = 0;	// Not in the file
+	
+	record_type = header->record_type;
+	window_size = header->config.window_size;
+	last_ms     = 0;
+	first       = 1;
+	threshold_records = (header->version >= 5);
+	threshold_max     = (uint32_t)header->config.vref_mv * header->config.rms_scale;
+	
+	// Records end at the trailer, if the session was stopped cleanly
+	uint8_t trailer_size = (header->version >= 4) ? sizeof(EmgLogTrailer) : REPLAY_TRAILER_V3_BYTES;
+	FSIZE_t size = f_size(&replay_file);
+	records_end = size;
+	if (size >= header->header_size + trailer_size
+	    && f_lseek(&replay_file, size - trailer_size) == FR_OK
+	    && f_read(&replay_file, magic, 4, &br) == FR_OK && br == 4
+	    && memcmp(magic, EMG_LOG_TRAILER_MAGIC, 4) == 0) {
+		records_end = size - trailer_size;
+	}
+	
+	res = f_lseek(&replay_file, header->header_size);
+	if (res != FR_OK) f_close(&replay_file);
+	return res;
+}
+
+uint8_t Replay_Next(uint32_t* t_ms, uint16_t* rms_mv, uint16_t* threshold_mv, uint8_t* packed, uint8_t* block) {
+	uint8_t value[2];
+	
+	if (!read_exact(t_ms, sizeof(*t_ms))) return 0;		// AVR is little-endian, same as the file
+	while (threshold_records && *t_ms == EMG_LOG_THRESHOLD_MARK) {
+		if (!read_exact(value, 2)) return 0;
+		uint16_t mv = value[0] | ((uint16_t)value[1] << 8);
+		if (mv > threshold_max) return 0;				// Not a record (erased sectors read as 0xFF)
+		*threshold_mv = mv;
+		if (!read_exact(t_ms, sizeof(*t_ms))) return 0;
+	}
+	if (!first && (*t_ms < last_ms || *t_ms - last_ms > REPLAY_MAX_GAP_MS)) return 0;	// Not a record (preallocated area after a crash)
+	last_ms = *t_ms;
+	first   = 0;
+	
+	switch (record_type) {
+		case EMG_LOG_RECORD_RMS:
+			if (!read_exact(value, 2)) return 0;
+			*rms_mv = value[0] | ((uint16_t)value[1] << 8);
+			return 1;
+		
+		case EMG_LOG_RECORD_RAW10:
+			return read_exact(packed, PACK10_BYTES(window_size));
+		
+		case EMG_LOG_RECORD_RICE: {
+			if (!read_exact(block, RICE_BLOCK_HEADER)) return 0;
+			uint16_t size = block[1] | ((uint16_t)block[2] << 8);
+			if (size > PACK10_BYTES(window_size)) return 0;
+			if (!read_exact(&block[RICE_BLOCK_HEADER], size)) return 0;
+			return Rice_DecodeBlock(block, window_size, packed) == 0;
+		}
+	}
+	return 0;
+}
+
+void Replay_Close(void) {
+	f_close(&replay_file);
+}
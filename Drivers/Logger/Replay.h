@@ -0,0 +1,31 @@
+#ifndef REPLAY_H_
+#define REPLAY_H_
+
+#include <stdint.h>
+#include "ff.h"
+#include "Logger.h"
+
+// ========== Log file replay ==========
+// Reads the windows of an EMG log file (Logger.h, version 3+) back in order, so they can be fed into the
+// same processing as live ADC windows. RMS logs give the logged RMS value per window, raw logs
+// (EMG_LOG_RECORD_RAW10 / EMG_LOG_RECORD_RICE) give the packed samples of the window.
+// Threshold records (version 5+) are applied on the way, so each window comes with the threshold it was decided with.
+// Records end at the trailer. A file without trailer (session not stopped cleanly) ends at the first
+// record that cannot be valid: a timestamp going backwards or jumping ahead by more than a minute, or a
+// corrupt coded block.
+
+// Opens 'filename' and reads its header. Returns FR_OK, or FR_INVALID_OBJECT if the file is not
+// an EMG log that can be replayed.
+FRESULT Replay_Open(const char* filename, EmgLogHeader* header);
+
+// Reads the next window: its timestamp and RMS value (RMS logs) or packed samples (raw logs,
+// PACK10_BYTES(window_size) bytes to 'packed'). 'block' is scratch space of RICE_BLOCK_MAX_BYTES(window_size)
+// bytes for coded windows. '*threshold_mv' is set when a threshold record comes before the window, otherwise
+// left unchanged (start it at header.config.threshold_mv).
+// Returns 1 when a window was read, 0 at the end of the records or on a read error.
+uint8_t Replay_Next(uint32_t* t_ms, uint16_t* rms_mv, uint16_t* threshold_mv, uint8_t* packed, uint8_t* block);
+
+// Closes the replayed file
+void Replay_Close(void);
+
+#endif /* REPLAY_H_ */
@@ -0,0 +1,25 @@
+#include "ReplayClock.h"
+
+// Log time reached at 'now'
+static uint32_t log_time(const ReplayClock* clock, uint32_t now) {
+	return clock->base_t + (now - clock->base_ms) * clock->speed;
+}
+
+void ReplayClock_Start(ReplayClock* clock, uint32_t t, uint32_t now) {
+	clock->base_t  = t;
+	clock->base_ms = now;
+	clock->speed   = 1;
+}
+
+uint8_t ReplayClock_Due(const ReplayClock* clock, uint32_t t, uint32_t now) {
+	return (int32_t)(t - log_time(clock, now)) <= 0;
+}
+
+void ReplayClock_SetSpeed(ReplayClock* clock, uint8_t speed, uint32_t now, uint32_t pending_t) {
+	uint32_t t = log_time(clock, now);
+	
+	if ((int32_t)(t - pending_t) > 0) t = pending_t;	// Overdue window: continue from it
+	clock->base_t  = t;
+	clock->base_ms = now;
+	clock->speed   = speed;
+}
@@ -0,0 +1,30 @@
+#ifndef REPLAYCLOCK_H_
+#define REPLAYCLOCK_H_
+
+#include <stdint.h>
+
+// ========== Replay timing ==========
+// Maps Timer_Millis() to log time at a speed factor. The log time at 'now' is
+// base_t + (now - base_ms) * speed; a window is due when its timestamp is not ahead of that.
+// Differences are compared signed, so a window that is already overdue (e.g. after a touch held the
+// main loop) stays due instead of wrapping to a time days ahead.
+
+typedef struct {
+	uint32_t base_t;		// Log time ...
+	uint32_t base_ms;		// ... at this Timer_Millis()
+	uint8_t  speed;			// Log milliseconds per real millisecond
+} ReplayClock;
+
+// Starts the clock at log time 't' at 'now', speed 1
+void ReplayClock_Start(ReplayClock* clock, uint32_t t, uint32_t now);
+
+// 1 if a window with timestamp 't' is due at 'now'
+uint8_t ReplayClock_Due(const ReplayClock* clock, uint32_t t, uint32_t now);
+
+// Changes the speed at 'now' and continues from the current log time. 'pending_t' is the timestamp of the
+// next window (or of the last one played): the clock is not moved past it, so an overdue window is played
+// right away and the following windows keep their spacing at the new speed.
+// Tools/replay_clock_test.c checks this on a PC.
+void ReplayClock_SetSpeed(ReplayClock* clock, uint8_t speed, uint32_t now, uint32_t pending_t);
+
+#endif /* REPLAYCLOCK_H_ */
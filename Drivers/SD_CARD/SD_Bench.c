@@ -0,0 +1,148 @@
+#ifdef SD_BENCHMARK
+
+#include <avr/io.h>
+#include <stdlib.h>
+#include "ff.h"
+#include "SD_Driver.h"
+#include "Timer_Driver.h"
+#include "USART_Driver.h"
+
+#define BENCH_FILE   "BENCH.BIN"
+#define BENCH_BYTES  65536UL	// Bytes written/read per measurement
+#define BENCH_CHUNK  2048		// Largest f_write/f_read size (4 sectors => disk_write/disk_read with count = 4)
+
+static FATFS bench_fs;
+static FIL   bench_file;
+static uint8_t bench_buf[BENCH_CHUNK];
+
+// Prints "<label>: <KB/s> KB/s (<us> us)" over USART0
+static void print_result(const char* label, uint32_t us) {
+	char num[12];
+	
+	USART0_SendString(label);
+	USART0_SendString(": ");
+	ultoa(BENCH_BYTES * 1000UL / 1024UL * 1000UL / us, num, 10);	// KB/s
+	USART0_SendString(num);
+	USART0_SendString(" KB/s (");
+	ultoa(us, num, 10);
+	USART0_SendString(num);
+	USART0_SendString(" us)\r\n");
+}
+
+// Writes BENCH_BYTES from the start of the file in 'chunk' sized f_write calls and returns the time in us.
+// Sector aligned chunks go straight to disk_write() with count = chunk / 512.
+static uint32_t bench_write(UINT chunk) {
+	UINT bw;
+	
+	f_lseek(&bench_file, 0);
+	uint32_t start = Timer_Micros();
+	for (uint32_t done = 0; done < BENCH_BYTES; done += chunk) {
+		f_write(&bench_file, bench_buf, chunk, &bw);
+	}
+	f_sync(&bench_file);
+	return Timer_Micros() - start;
+}
+
+// Reads BENCH_BYTES from the start of the file in 'chunk' sized f_read calls and returns the time in us
+static uint32_t bench_read(UINT chunk) {
+	UINT br;
+	
+	f_lseek(&bench_file, 0);
+	uint32_t start = Timer_Micros();
+	for (uint32_t done = 0; done < BENCH_BYTES; done += chunk) {
+		f_read(&bench_file, bench_buf, chunk, &br);
+	}
+	return Timer_Micros() - start;
+}
+
+// Times 'BENCH_PUMP_SECTORS' sector transfers through the per-byte routines and the sector pumps.
+// The card is deselected (CS high), so only the SPI bus is measured.
+#define BENCH_PUMP_SECTORS 64
+
+static void bench_pump(void) {
+	uint32_t start, us;
+	char num[12];
+	
+	static const char* const labels[6] = {
+		"SPI_send_multi        ", "SPI_send_sector       ", "SPI_send_sector_crc   ",
+		"SPI_receive_multi     ", "SPI_receive_sector    ", "SPI_receive_sector_crc"
+	};
+	
+	for (uint8_t test = 0; test < 6; test++) {
+		start = Timer_Micros();
+		for (uint8_t n = 0; n < BENCH_PUMP_SECTORS; n++) {
+			switch (test) {
+				case 0: SPI_send_multi(bench_buf, 512);    break;
+				case 1: SPI_send_sector(bench_buf);        break;
+				case 2: SPI_send_sector_crc(bench_buf);    break;
+				case 3: SPI_receive_multi(bench_buf, 512); break;
+				case 4: SPI_receive_sector(bench_buf);     break;
+				case 5: SPI_receive_sector_crc(bench_buf); break;
+			}
+		}
+		us = Timer_Micros() - start;
+		
+		// Cycles per byte = us * 16 (16 MHz) / bytes
+		USART0_SendString(labels[test]);
+		USART0_SendString(": ");
+		ultoa(us / BENCH_PUMP_SECTORS, num, 10);
+		USART0_SendString(num);
+		USART0_SendString(" us/sector, ");
+		ultoa(us * 16UL / (BENCH_PUMP_SECTORS * 512UL), num, 10);
+		USART0_SendString(num);
+		USART0_SendString(" cycles/byte\r\n");
+	}
+}
+
+void SD_Bench_Run(void) {
+	if (f_mount(&bench_fs, "", 1) != FR_OK) {
+		USART0_SendString("bench: mount failed\r\n");
+		return;
+	}
+	if (f_open(&bench_file, BENCH_FILE, FA_WRITE | FA_READ | FA_CREATE_ALWAYS) != FR_OK) {
+		USART0_SendString("bench: open failed\r\n");
+		return;
+	}
+	
+	for (uint16_t i = 0; i < BENCH_CHUNK; i++) bench_buf[i] = (uint8_t)i;
+	
+	// First pass allocates the clusters, so the timed passes only measure data transfer
+	bench_write(BENCH_CHUNK);
+	
+	// Repeat at every SPI speed, fastest first
+	static const char* const speed_names[SD_SPEED_COUNT] = { "8 MHz\r\n", "4 MHz\r\n", "2 MHz\r\n", "1 MHz\r\n" };
+	uint8_t selected = SD_get_speed();
+	
+	for (uint8_t speed = 0; speed < SD_SPEED_COUNT; speed++) {
+		SD_set_speed(speed);
+		USART0_SendString(speed_names[speed]);
+		print_result("write 1 sector/call ", bench_write(512));			// CMD24 per sector
+		print_result("write 4 sectors/call", bench_write(BENCH_CHUNK));	// CMD25 per 4 sectors
+		print_result("read  1 sector/call ", bench_read(512));			// CMD17 per sector
+		print_result("read  4 sectors/call", bench_read(BENCH_CHUNK));	// CMD18 + CMD12 per 4 sectors
+		bench_pump();
+	}
+	
+	SD_set_speed(selected);	// Back to the speed SD_init() selected
+	USART0_SendString("selected: ");
+	USART0_SendString(speed_names[selected]);
+	
+	// CRC overhead at the selected speed (CMD59 off, then on)
+	uint8_t crc = SD_get_crc();
+	for (uint8_t on = 0; on < 2; on++) {
+		if (SD_set_crc(on) != 0) {
+			USART0_SendString("bench: CMD59 failed\r\n");
+			break;
+		}
+		USART0_SendString(on ? "CRC on\r\n" : "CRC off\r\n");
+		print_result("write 4 sectors/call", bench_write(BENCH_CHUNK));
+		print_result("read  4 sectors/call", bench_read(BENCH_CHUNK));
+	}
+	SD_set_crc(crc);
+	
+	f_close(&bench_file);
+	f_unlink(BENCH_FILE);
+	f_mount(0, "", 0);
+}
+
+#endif
@@ -0,0 +1,8 @@
+#ifndef SD_BENCH_H
+#define SD_BENCH_H
+
+// SD card throughput benchmark.
+// Only built when SD_BENCHMARK is defined. Results are printed over USART0 (USART0_Init must be called first).
+void SD_Bench_Run(void);
+
+#endif
@@ -1,9 +1,13 @@
 #define F_CPU 16000000UL
 #include <avr/io.h>
+#include <avr/interrupt.h>
+#include <avr/pgmspace.h>
 #include <util/delay.h>
+#include <string.h>
 #include "diskio.h"
 #include "ff.h"
 #include "SD_Driver.h"
+#include "Timer_Driver.h"
 
 // --- Adjusted for Mega 2560 SPI pins (PORTB) ---
 #define SPI_DDR    DDRB
@@ -18,16 +22,100 @@
 
 #define CMD0    0
 #define CMD8    8
+#define CMD9    9
+#define CMD12   12
+#define CMD13   13
+#define CMD16   16
 #define CMD17   17
+#define CMD18   18
 #define CMD24   24
+#define CMD25   25
 #define CMD55   55
 #define CMD58   58
+#define CMD59   59
+#define ACMD23  23
 #define ACMD41  41
 
 #define DEV_MMC 0
 
 static volatile DSTATUS Stat = STA_NOINIT;
 
+static uint8_t CardType    = 0;		// CT_SD1 / CT_SD2 og CT_BLOCK (sat af SD_init)
+static DWORD   CardSectors = 0;		// Kortets strrelse i sektorer (512b), lst fra CSD
+static uint8_t CardCsd[16];			// CSD register (CMD9)
+static uint8_t CardOcr[4];			// OCR register (CMD58)
+
+static uint8_t  StreamActive = 0;	// 1 = CMD25 stream er ben, kortet venter p nste blok (SD_stream_write)
+static uint32_t StreamNext;			// Blok-nummer kortet forventer som det nste
+static uint32_t ExtentStart = 0;	// Omrde der snart skrives i rkkeflge (MMC_SET_WRITE_EXTENT), ExtentEnd = frste blok efter
+static uint32_t ExtentEnd   = 0;
+static volatile uint8_t CardBusy = 0;	// 1 = kortet programmerer mske stadig flash efter sidste skrivning (se SD_busy_wait)
+
+// Baggrunds-overfrsel af n sektor (SPI_STC_vect, se SD_stream_write_async)
+static const uint8_t*        AsyncBuf;			// Sektoren der sendes
+static volatile uint16_t     AsyncCount;		// Antal bytes startet indtil nu
+static volatile uint8_t      AsyncActive = 0;	// 1 = SPI ejes af interrupt-motoren
+static volatile uint8_t      AsyncFailed = 0;	// 1 = kortet afviste sidste baggrunds-blok --> stream genstartes
+static SD_async_callback     AsyncDone;			// Kaldes fra interruptet nr blokken er frdig
+
+static SdErrorCounters Errors;					// Fejltllere (SD_get_errors)
+static volatile uint16_t     AsyncCrc;			// CRC16 af de bytes interruptet har sendt indtil nu
+
+static uint8_t CrcEnabled = 0;					// 1 = CRC er slet til p kortet (CMD59), se SD_set_crc
+
+// CRC16-CCITT (polynomium 0x1021, start 0) som SD-kortet bruger til datablokke. Tabel med n vrdi pr. byte (512 bytes flash)
+static const uint16_t Crc16Table[256] PROGMEM = {
+	0x0000, 0x1021, 0x2042, 0x3063, 0x4084, 0x50A5, 0x60C6, 0x70E7,
+	0x8108, 0x9129, 0xA14A, 0xB16B, 0xC18C, 0xD1AD, 0xE1CE, 0xF1EF,
+	0x1231, 0x0210, 0x3273, 0x2252, 0x52B5, 0x4294, 0x72F7, 0x62D6,
+	0x9339, 0x8318, 0xB37B, 0xA35A, 0xD3BD, 0xC39C, 0xF3FF, 0xE3DE,
+	0x2462, 0x3443, 0x0420, 0x1401, 0x64E6, 0x74C7, 0x44A4, 0x5485,
+	0xA56A, 0xB54B, 0x8528, 0x9509, 0xE5EE, 0xF5CF, 0xC5AC, 0xD58D,
+	0x3653, 0x2672, 0x1611, 0x0630, 0x76D7, 0x66F6, 0x5695, 0x46B4,
+	0xB75B, 0xA77A, 0x9719, 0x8738, 0xF7DF, 0xE7FE, 0xD79D, 0xC7BC,
+	0x48C4, 0x58E5, 0x6886, 0x78A7, 0x0840, 0x1861, 0x2802, 0x3823,
+	0xC9CC, 0xD9ED, 0xE98E, 0xF9AF, 0x8948, 0x9969, 0xA90A, 0xB92B,
+	0x5AF5, 0x4AD4, 0x7AB7, 0x6A96, 0x1A71, 0x0A50, 0x3A33, 0x2A12,
+	0xDBFD, 0xCBDC, 0xFBBF, 0xEB9E, 0x9B79, 0x8B58, 0xBB3B, 0xAB1A,
+	0x6CA6, 0x7C87, 0x4CE4, 0x5CC5, 0x2C22, 0x3C03, 0x0C60, 0x1C41,
+	0xEDAE, 0xFD8F, 0xCDEC, 0xDDCD, 0xAD2A, 0xBD0B, 0x8D68, 0x9D49,
+	0x7E97, 0x6EB6, 0x5ED5, 0x4EF4, 0x3E13, 0x2E32, 0x1E51, 0x0E70,
+	0xFF9F, 0xEFBE, 0xDFDD, 0xCFFC, 0xBF1B, 0xAF3A, 0x9F59, 0x8F78,
+	0x9188, 0x81A9, 0xB1CA, 0xA1EB, 0xD10C, 0xC12D, 0xF14E, 0xE16F,
+	0x1080, 0x00A1, 0x30C2, 0x20E3, 0x5004, 0x4025, 0x7046, 0x6067,
+	0x83B9, 0x9398, 0xA3FB, 0xB3DA, 0xC33D, 0xD31C, 0xE37F, 0xF35E,
+	0x02B1, 0x1290, 0x22F3, 0x32D2, 0x4235, 0x5214, 0x6277, 0x7256,
+	0xB5EA, 0xA5CB, 0x95A8, 0x8589, 0xF56E, 0xE54F, 0xD52C, 0xC50D,
+	0x34E2, 0x24C3, 0x14A0, 0x0481, 0x7466, 0x6447, 0x5424, 0x4405,
+	0xA7DB, 0xB7FA, 0x8799, 0x97B8, 0xE75F, 0xF77E, 0xC71D, 0xD73C,
+	0x26D3, 0x36F2, 0x0691, 0x16B0, 0x6657, 0x7676, 0x4615, 0x5634,
+	0xD94C, 0xC96D, 0xF90E, 0xE92F, 0x99C8, 0x89E9, 0xB98A, 0xA9AB,
+	0x5844, 0x4865, 0x7806, 0x6827, 0x18C0, 0x08E1, 0x3882, 0x28A3,
+	0xCB7D, 0xDB5C, 0xEB3F, 0xFB1E, 0x8BF9, 0x9BD8, 0xABBB, 0xBB9A,
+	0x4A75, 0x5A54, 0x6A37, 0x7A16, 0x0AF1, 0x1AD0, 0x2AB3, 0x3A92,
+	0xFD2E, 0xED0F, 0xDD6C, 0xCD4D, 0xBDAA, 0xAD8B, 0x9DE8, 0x8DC9,
+	0x7C26, 0x6C07, 0x5C64, 0x4C45, 0x3CA2, 0x2C83, 0x1CE0, 0x0CC1,
+	0xEF1F, 0xFF3E, 0xCF5D, 0xDF7C, 0xAF9B, 0xBFBA, 0x8FD9, 0x9FF8,
+	0x6E17, 0x7E36, 0x4E55, 0x5E74, 0x2E93, 0x3EB2, 0x0ED1, 0x1EF0
+};
+#define CRC16_UPDATE(crc, b)  (((crc) << 8) ^ pgm_read_word(&Crc16Table[(uint8_t)((crc) >> 8) ^ (b)]))
+
+// SPI hastigheder (F_CPU = 16 MHz), hurtigste frst --> indeks = SD_SPEED_xxx
+static const struct {
+	uint8_t spcr;
+	uint8_t spsr;
+} SpiSpeeds[SD_SPEED_COUNT] = {
+	{ (1<<SPE)|(1<<MSTR),           (1<<SPI2X) },	// f/2  = 8 MHz
+	{ (1<<SPE)|(1<<MSTR),           0          },	// f/4  = 4 MHz
+	{ (1<<SPE)|(1<<MSTR)|(1<<SPR0), (1<<SPI2X) },	// f/8  = 2 MHz
+	{ (1<<SPE)|(1<<MSTR)|(1<<SPR0), 0          },	// f/16 = 1 MHz
+};
+
+static uint8_t SpiSpeed = SD_SPEED_1MHZ;	// Aktuel SPI hastighed efter init
+
+// SDSC-kort bruger byte-adresser, SDHC/SDXC bruger blok-numre
+#define SD_ADDR(block)  ((CardType & CT_BLOCK) ? (block) : (block) * 512UL)
+
 void SPI_init(void) {
 	SPI_DDR |= (1<<DD_MOSI)|(1<<DD_SCK)|(1<<DD_SS);	// MOSI, SCK, SS as OUTPUT
 	SPI_DDR &= ~(1<<DD_MISO);						// MISO as INPUT
@@ -54,6 +142,166 @@ void SPI_receive_multi(uint8_t* data, uint16_t len) {
 	while (len--) *data++ = SPI_receive();
 }
 
+// Sektor-pumper (512 bytes) til datablokke
+// SPI_send_multi/SPI_receive_multi kalder SPI_transmit for hver byte: ca. 33 cykler pr. byte ved 8 MHz SPI,
+// hvoraf 16 er selve SPI-overfrslen og resten er kald, retur og lkke mellem bytes.
+// Her er nste byte allerede hentet i et register nr SPIF sttes, s SPDR skrives 2-3 cykler efter
+// og lkken er rullet ud 8 gange: ca. 19 cykler pr. byte --> ca. 9.700 i stedet for 16.900 cykler pr. sektor.
+// (Estimeret ud fra instruktionerne, SD_Bench mler de faktiske tider.)
+
+// n byte ud: hent nste byte, vent p SPIF, skriv SPDR (lsning af SPSR + skrivning af SPDR nulstiller SPIF)
+#define SPI_PUMP_TX() { b = *data++; while (!(SPSR & (1<<SPIF))); SPDR = b; }
+
+// n byte ind: vent p SPIF, ls SPDR, start nste byte straks, gem bagefter
+#define SPI_PUMP_RX() { while (!(SPSR & (1<<SPIF))); b = SPDR; SPDR = 0xFF; *data++ = b; }
+
+void SPI_send_sector(const uint8_t* data) {
+	uint8_t b, i;
+	
+	SPDR = *data++;					// Byte 0
+	for (i = 0; i < 63; i++) {		// Byte 1-504
+		SPI_PUMP_TX(); SPI_PUMP_TX(); SPI_PUMP_TX(); SPI_PUMP_TX();
+		SPI_PUMP_TX(); SPI_PUMP_TX(); SPI_PUMP_TX(); SPI_PUMP_TX();
+	}
+	SPI_PUMP_TX(); SPI_PUMP_TX(); SPI_PUMP_TX(); SPI_PUMP_TX();	// Byte 505-511
+	SPI_PUMP_TX(); SPI_PUMP_TX(); SPI_PUMP_TX();
+	while (!(SPSR & (1<<SPIF)));	// Vent p sidste byte
+	(void)SPDR;						// Nulstil SPIF
+}
+
+void SPI_receive_sector(uint8_t* data) {
+	uint8_t b, i;
+	
+	SPDR = 0xFF;					// Start byte 0
+	for (i = 0; i < 63; i++) {		// Byte 0-503
+		SPI_PUMP_RX(); SPI_PUMP_RX(); SPI_PUMP_RX(); SPI_PUMP_RX();
+		SPI_PUMP_RX(); SPI_PUMP_RX(); SPI_PUMP_RX(); SPI_PUMP_RX();
+	}
+	SPI_PUMP_RX(); SPI_PUMP_RX(); SPI_PUMP_RX(); SPI_PUMP_RX();	// Byte 504-510
+	SPI_PUMP_RX(); SPI_PUMP_RX(); SPI_PUMP_RX();
+	while (!(SPSR & (1<<SPIF)));	// Byte 511
+	*data = SPDR;
+}
+
+// Sektor-pumper med CRC16: CRC'en for en byte beregnes mens den nste byte er p vej ud over SPI,
+// s beregningen for det meste skjules i ventetiden (SD_Bench mler den ekstra tid)
+#define SPI_PUMP_TX_CRC() { b = *data++; while (!(SPSR & (1<<SPIF))); SPDR = b; crc = CRC16_UPDATE(crc, b); }
+#define SPI_PUMP_RX_CRC() { while (!(SPSR & (1<<SPIF))); b = SPDR; SPDR = 0xFF; *data++ = b; crc = CRC16_UPDATE(crc, b); }
+
+// Sender 512 bytes og returnerer deres CRC16
+uint16_t SPI_send_sector_crc(const uint8_t* data) {
+	uint8_t b, i;
+	uint16_t crc = 0;
+	
+	b = *data++;
+	SPDR = b;						// Byte 0
+	crc = CRC16_UPDATE(crc, b);
+	for (i = 0; i < 63; i++) {		// Byte 1-504
+		SPI_PUMP_TX_CRC(); SPI_PUMP_TX_CRC(); SPI_PUMP_TX_CRC(); SPI_PUMP_TX_CRC();
+		SPI_PUMP_TX_CRC(); SPI_PUMP_TX_CRC(); SPI_PUMP_TX_CRC(); SPI_PUMP_TX_CRC();
+	}
+	SPI_PUMP_TX_CRC(); SPI_PUMP_TX_CRC(); SPI_PUMP_TX_CRC(); SPI_PUMP_TX_CRC();	// Byte 505-511
+	SPI_PUMP_TX_CRC(); SPI_PUMP_TX_CRC(); SPI_PUMP_TX_CRC();
+	while (!(SPSR & (1<<SPIF)));	// Vent p sidste byte
+	(void)SPDR;						// Nulstil SPIF
+	return crc;
+}
+
+// Modtager 512 bytes og returnerer deres CRC16
+uint16_t SPI_receive_sector_crc(uint8_t* data) {
+	uint8_t b, i;
+	uint16_t crc = 0;
+	
+	SPDR = 0xFF;					// Start byte 0
+	for (i = 0; i < 63; i++) {		// Byte 0-503
+		SPI_PUMP_RX_CRC(); SPI_PUMP_RX_CRC(); SPI_PUMP_RX_CRC(); SPI_PUMP_RX_CRC();
+		SPI_PUMP_RX_CRC(); SPI_PUMP_RX_CRC(); SPI_PUMP_RX_CRC(); SPI_PUMP_RX_CRC();
+	}
+	SPI_PUMP_RX_CRC(); SPI_PUMP_RX_CRC(); SPI_PUMP_RX_CRC(); SPI_PUMP_RX_CRC();	// Byte 504-510
+	SPI_PUMP_RX_CRC(); SPI_PUMP_RX_CRC(); SPI_PUMP_RX_CRC();
+	while (!(SPSR & (1<<SPIF)));	// Byte 511
+	b = SPDR;
+	*data = b;
+	return CRC16_UPDATE(crc, b);
+}
+
+// CRC16 af en buffer (bruges til korte datablokke, f.eks. CSD)
+static uint16_t SD_crc16(const uint8_t* data, uint16_t len) {
+	uint16_t crc = 0;
+	while (len--) crc = CRC16_UPDATE(crc, *data++);
+	return crc;
+}
+
+// CRC7 af kommando-byte + 32-bit argument. Returnerer sidste kommando-byte (CRC7 + stopbit)
+static uint8_t SD_crc7(uint8_t cmd, uint32_t arg) {
+	uint8_t bytes[5] = { 0x40 | cmd, (uint8_t)(arg >> 24), (uint8_t)(arg >> 16), (uint8_t)(arg >> 8), (uint8_t)arg };
+	uint8_t crc = 0;
+	
+	for (uint8_t i = 0; i < 5; i++) {
+		uint8_t d = bytes[i];
+		for (uint8_t bit = 0; bit < 8; bit++) {
+			crc <<= 1;
+			if ((d ^ crc) & 0x80) crc ^= 0x09;
+			d <<= 1;
+		}
+	}
+	return (uint8_t)((crc << 1) | 0x01);
+}
+
+// Venter til en baggrunds-overfrsel er frdig, s SPI kan bruges i forgrunden igen
+// Bliver den ikke frdig inden SD_TIMEOUT_ASYNC_MS, afbrydes den: blokken regnes som fejlet
+// og den bne stream genstartes ved nste skrivning
+// Returnerer 0 hvis SPI er fri, ellers SD_ERR_ASYNC
+uint8_t SD_async_wait(void) {
+	uint32_t start = Timer_Millis();
+	
+	while (AsyncActive) {
+		if (Timer_Millis() - start > SD_TIMEOUT_ASYNC_MS) {
+			uint8_t sreg = SREG;
+			cli();							// Interruptet m ikke blive frdig midt i afbrydelsen
+			uint8_t aborted = AsyncActive;
+			if (aborted) {
+				SPCR = SpiSpeeds[SpiSpeed].spcr;	// SPIE fra
+				SPSR = SpiSpeeds[SpiSpeed].spsr;
+				CardBusy    = 1;
+				AsyncFailed = 1;
+				AsyncActive = 0;
+				Errors.async++;
+			}
+			SREG = sreg;
+			if (!aborted) return 0;
+			if (AsyncDone) AsyncDone(1);
+			return SD_ERR_ASYNC;
+		}
+	}
+	return 0;
+}
+
+// Venter til kortet er frdigt med at programmere flash (CS skal vre LOW)
+// S lnge SD-kort sender 0x00 er det 'busy' --> skriver internt til dets flash
+// Returnerer 0 nr kortet er klar, SD_ERR_BUSY hvis det stadig er busy efter SD_TIMEOUT_BUSY_MS
+static uint8_t SD_busy_wait(void) {
+	if (SD_async_wait() != 0) return SD_ERR_ASYNC;
+	if (!CardBusy) return 0;
+	
+	uint32_t start = Timer_Millis();
+	while (SPI_receive() == 0x00) {
+		if (Timer_Millis() - start > SD_TIMEOUT_BUSY_MS) {
+			Errors.busy++;
+			return SD_ERR_BUSY;			// CardBusy forbliver 1 --> der ventes igen ved nste kald
+		}
+	}
+	CardBusy = 0;
+	return 0;
+}
+
+void SD_get_errors(SdErrorCounters* out) {
+	uint8_t sreg = SREG;
+	cli();						// Interruptet tller ogs (data response fejl)
+	*out = Errors;
+	SREG = sreg;
+}
+
 // Sender kommmando og venter p svar
 // Flger SD SPI-protokollen som definerer at kommandoer skal sendes som:
 //      1 byte: kommando (med startbit)
@@ -63,6 +311,8 @@ void SPI_receive_multi(uint8_t* data, uint16_t len) {
 uint8_t SD_send_cmd(uint8_t cmd, uint32_t arg, uint8_t crc) {
 	uint8_t response, retry = 0;
 	CS_LOW();								// vlg SD-kort (chip select LOW)
+	if (SD_busy_wait() != 0) return 0xFF;	// kortet tager ikke imod kommandoer mens det er busy --> som 'intet svar'
+	if (CrcEnabled) crc = SD_crc7(cmd, arg);	// Med CRC slet til tjekker kortet alle kommandoer
 	SPI_transmit(0xFF);						// lead-in (sikrer korrekt timing)
 	SPI_transmit(0x40 | cmd);				// kommando-byte (startbit + index)
 	
@@ -73,18 +323,126 @@ uint8_t SD_send_cmd(uint8_t cmd, uint32_t arg, uint8_t crc) {
 	SPI_transmit((uint8_t)arg);
 	SPI_transmit(crc);
 	
+	// Efter CMD12 (STOP_TRANSMISSION) sender kortet en 'stuff byte' fr svaret --> skal springes over
+	if (cmd == CMD12) SPI_receive();
+	
 	// Vent for respons
 	do {
 		response = SPI_receive();
-	} while ((response & 0x80) && ++retry < 10); // R1 har bestemt format && prver 10 gange
+	} while ((response & 0x80) && ++retry < 10); // R1 har bestemt format && prver 10 gange (spec: svar inden 8 bytes)
+	
+	if (response & 0x80) Errors.cmd++;		// Intet svar
 	return response;
 }
 
+// Modtager n datablok p 'len' bytes efter en lsekommando (512b for sektorer, 16b for CSD)
+// Venter p 'data-start' token (0xFE), lser blokken og smider CRC vk
+// Returnerer 0, eller SD_ERR_TOKEN hvis start token ikke kom inden SD_TIMEOUT_READ_MS
+static uint8_t SD_receive_data_block(uint8_t* buff, uint16_t len) {
+	uint32_t start = Timer_Millis();
+	
+	while (SPI_receive() != 0xFE) {
+		if (Timer_Millis() - start > SD_TIMEOUT_READ_MS) {
+			Errors.token++;
+			return SD_ERR_TOKEN;
+		}
+	}
+	
+	// Ls blokken fra SD kort og gem i buff
+	if (!CrcEnabled) {
+		if (len == 512) SPI_receive_sector(buff);
+		else SPI_receive_multi(buff, len);
+		
+		SPI_receive();	// CRC
+		SPI_receive();	// CRC
+		return 0;
+	}
+	
+	uint16_t crc;
+	if (len == 512) {
+		crc = SPI_receive_sector_crc(buff);
+	} else {
+		SPI_receive_multi(buff, len);
+		crc = SD_crc16(buff, len);
+	}
+	uint16_t card_crc = (uint16_t)SPI_receive() << 8;
+	card_crc |= SPI_receive();
+	
+	if (crc != card_crc) {
+		Errors.crc++;
+		return SD_ERR_CRC;		// Data er delagt p vej over SPI --> lses igen (evt. ved lavere hastighed)
+	}
+	return 0;
+}
+
+// Beregner kortets strrelse i sektorer (512b) ud fra CSD registret
+static DWORD SD_csd_sector_count(const uint8_t* csd) {
+	if ((csd[0] >> 6) == 1) {
+		// CSD version 2.0 (SDHC/SDXC): strrelse = (C_SIZE + 1) * 512 KB
+		DWORD c_size = ((DWORD)(csd[7] & 0x3F) << 16) | ((DWORD)csd[8] << 8) | csd[9];
+		return (c_size + 1) << 10;
+	} else {
+		// CSD version 1.0 (SDSC): strrelse = (C_SIZE + 1) * 2^(C_SIZE_MULT + 2) * 2^READ_BL_LEN
+		uint8_t n = (csd[5] & 0x0F) + ((csd[10] & 0x80) >> 7) + ((csd[9] & 0x03) << 1) + 2;
+		DWORD c_size = (csd[8] >> 6) + ((WORD)csd[7] << 2) + ((WORD)(csd[6] & 0x03) << 10) + 1;
+		return c_size << (n - 9);
+	}
+}
+
+// Stter SPI hastigheden (SD_SPEED_8MHZ ... SD_SPEED_1MHZ)
+void SD_set_speed(uint8_t speed) {
+	if (speed >= SD_SPEED_COUNT) speed = SD_SPEED_COUNT - 1;
+	SPCR = SpiSpeeds[speed].spcr;
+	SPSR = SpiSpeeds[speed].spsr;
+	SpiSpeed = speed;
+}
+
+uint8_t SD_get_speed(void) {
+	return SpiSpeed;
+}
+
+// Finder den hurtigste SPI hastighed kortet kan klare
+// CSD registret lses igen ved hver hastighed og sammenlignes med det der blev lst ved lav hastighed
+// Frste hastighed hvor kommandoen lykkes og alle 16 bytes er ens vlges
+static void SD_select_speed(void) {
+	uint8_t csd[16];
+	uint8_t speed;
+	
+	for (speed = 0; speed < SD_SPEED_COUNT - 1; speed++) {
+		SD_set_speed(speed);
+		if (SD_send_cmd(CMD9, 0, 0x01) == 0x00 && SD_receive_data_block(csd, 16) == 0 && memcmp(csd, CardCsd, 16) == 0) {
+			break;
+		}
+		CS_HIGH(); SPI_transmit(0xFF);
+	}
+	CS_HIGH(); SPI_transmit(0xFF);
+	
+	SD_set_speed(speed);	// Hvis ingen hastighed virkede, bruges den langsomste
+}
+
+// Fejl ved ls/skriv --> skift til nste langsommere hastighed
+// Returnerer 1 hvis der blev skiftet (kald kan prves igen), 0 hvis allerede ved laveste hastighed
+static uint8_t SD_speed_fallback(void) {
+	if (SpiSpeed + 1 >= SD_SPEED_COUNT) return 0;
+	SD_set_speed(SpiSpeed + 1);
+	return 1;
+}
+
 // Initialiserer SD-kort
-// Bringer det fra idle til ready state
+// Bringer det fra idle til ready state, finder korttype (SDSC/SDHC) og strrelse
 // Stter SPI-hastigheden op igen
 uint8_t SD_init(void) {
-	uint8_t i, response;
+	uint8_t i, response, type;
+	uint8_t r7[4];
+	uint32_t acmd41_arg;
+	
+	SD_async_wait();	// SPI_init() m ikke sl interruptet fra midt i en overfrsel
+	CardType = 0;
+	ExtentStart = ExtentEnd = 0;
+	CrcEnabled = 0;		// Kortet starter altid med CRC slet fra (undtagen CMD0/CMD8)
+	StreamActive = 0;
+	CardBusy = 0;
+	AsyncFailed = 0;
 	SPI_init();		// Har lav hastighed defineret
 	CS_HIGH();		// Frakobler SD-kortet
 	
@@ -109,66 +467,162 @@ uint8_t SD_init(void) {
 	
 	// Efter CMD8 svarer SD-kortet med R7 respons:
 			// 1 byte R1-status
-			// 4 bytes ekstra
-	for (i = 0; i < 4; i++) SPI_receive();
+			// 4 bytes ekstra (de sidste to er 0x01 og 0xAA ekko)
+	for (i = 0; i < 4; i++) r7[i] = SPI_receive();
 	
 	// clean exit
 	CS_HIGH(); SPI_transmit(0xFF);
 	
-	// Tjekker svaret fra CMD8 --> hvis ikke 0x01 returneres fejl 2
-	if (response != 0x01) return 2;
+	// 0x01 = SD version 2 (kan vre SDSC eller SDHC/SDXC), 'illegal command' = SD version 1 (altid SDSC)
+	if (response == 0x01) {
+		if (r7[2] != 0x01 || r7[3] != 0xAA) return 2;	// Kortet understtter ikke 3.3V --> fejl 2
+		type = CT_SD2;
+		acmd41_arg = 0x40000000;						// HCS bit: host understtter SDHC
+	} else if (response & 0x04) {
+		type = CT_SD1;
+		acmd41_arg = 0;
+	} else {
+		return 2;
+	}
+	
+	// CMD59 (CRC_ON_OFF): fra nu af sendes/tjekkes CRC p kommandoer og datablokke
+	if (SD_USE_CRC && SD_set_crc(1) != 0) return 2;
 	
-	// Initialiseringsloop krer 100 gange --> SD skal returnere 0x00 for at vre klar til brug
-	for (i = 0; i < 100; i++) {
+	// Initialiseringsloop krer op til SD_TIMEOUT_INIT_MS --> SD skal returnere 0x00 for at vre klar til brug
+	uint32_t start = Timer_Millis();
+	do {
 		SD_send_cmd(CMD55, 0, 0x65);
-		response = SD_send_cmd(ACMD41, 0x40000000, 0x77);
+		response = SD_send_cmd(ACMD41, acmd41_arg, 0x77);
 		CS_HIGH(); SPI_transmit(0xFF);
 		if (response == 0x00) break;
 		_delay_ms(10);
-	}
+	} while (Timer_Millis() - start < SD_TIMEOUT_INIT_MS);
 	
 	// Hvis kortet ikke er klar (ingen 0x00 respons) returner fejl 3
 	if (response != 0x00) return 3;
 	
-	// Sender CMD58
+	// Sender CMD58 (READ_OCR) --> OCR gemmes til CCS-bit og MMC_GET_OCR
 	response = SD_send_cmd(CMD58, 0, 0);
-	for (i = 0; i < 4; i++) SPI_receive();
+	for (i = 0; i < 4; i++) CardOcr[i] = SPI_receive();
 	
 	// Afslutter med dummy bytes
 	CS_HIGH(); SPI_transmit(0xFF);
 	
-	// ger SPI hastighed p MEGA
-	SPCR = (1<<SPE)|(1<<MSTR);
+	// CCS-bit (bit 30 i OCR) = 1 --> SDHC/SDXC med blok-adressering, ellers SDSC med byte-adressering
+	if (type == CT_SD2 && response == 0x00 && (CardOcr[0] & 0x40)) type |= CT_BLOCK;
+	
+	// SDSC: st blokstrrelsen til 512 bytes (CMD16), s ls/skriv altid er n sektor
+	if (!(type & CT_BLOCK)) {
+		response = SD_send_cmd(CMD16, 512, 0x01);
+		CS_HIGH(); SPI_transmit(0xFF);
+		if (response != 0x00) return 4;
+	}
+	
+	// Sender CMD9 (SEND_CSD) --> CSD registret (16 bytes) sendes som en datablok
+	response = SD_send_cmd(CMD9, 0, 0x01);
+	if (response != 0x00 || SD_receive_data_block(CardCsd, 16) != 0) { CS_HIGH(); return 5; }
+	CS_HIGH(); SPI_transmit(0xFF);
+	
+	CardType    = type;
+	CardSectors = SD_csd_sector_count(CardCsd);
+	
+	// ger SPI hastighed p MEGA --> hurtigste hastighed kortet accepterer (op til 8 MHz)
+	SD_select_speed();
 	
 	// Returnerer 0 hvis alt lykkedes
 	return 0;
 }
 
+// Sender n datablok (512b) efter 'token'
+// Venter IKKE mens kortet skriver blokken til flash (kan tage 10-100+ ms): kortet markeres som busy,
+// og der ventes frst nr kortet skal bruges igen (nste kommando eller blok, se SD_busy_wait)
+// Returnerer 0 hvis kortet svarede 'data accepted', ellers SD_ERR_DATA (eller SD_ERR_BUSY / SD_ERR_ASYNC)
+static uint8_t SD_send_data_block(uint8_t token, const uint8_t* buff) {
+	uint8_t err = SD_busy_wait();	// Forrige blok i samme multi-block write skal vre skrevet frdig
+	if (err) return err;
+	SPI_transmit(token);		// 'data-start' token
+	if (CrcEnabled) {
+		uint16_t crc = SPI_send_sector_crc(buff);	// Sender 512 bytes fra buff via SPI
+		SPI_transmit(crc >> 8);
+		SPI_transmit((uint8_t)crc);
+	} else {
+		SPI_send_sector(buff);		// Sender 512 bytes fra buff via SPI
+		SPI_transmit(0xFF);			// dummy CRC
+		SPI_transmit(0xFF);			// dummy CRC
+	}
+	
+	// Kortet gr busy efter data response (ogs ved fejl)
+	uint8_t response = SPI_receive() & 0x1F;
+	CardBusy = 1;
+	
+	// Kun hvis data token's laveste bits = 0x05 er 'data accepted', 0x0B = CRC fejl
+	if (response == 0x0B) {
+		Errors.crc++;
+		return SD_ERR_CRC;
+	}
+	if (response != 0x05) {
+		Errors.data++;
+		return SD_ERR_DATA;
+	}
+	return 0;
+}
+
+// Afslutter en multi-block write med 'stop-tran' token
+// Kortet gr busy mens det afslutter programmeringen --> der ventes frst ved nste brug af kortet
+static void SD_stop_multiple_write(void) {
+	SD_busy_wait();					// 'stop-tran' m frst sendes nr sidste blok er skrevet (ved timeout sendes den alligevel)
+	SPI_transmit(0xFD);				// 'stop-tran' token
+	SPI_receive();					// Kortet m bruge n byte fr busy starter
+	CardBusy = 1;
+	
+	// Afslut med CS high og dummy bytes
+	CS_HIGH();
+	SPI_transmit(0xFF);
+}
+
+// Tjekker uden at vente om kortet stadig er busy efter en skrivning
+// Returnerer 1 hvis kortet er busy, 0 hvis det er klar
+uint8_t SD_poll_busy(void) {
+	if (AsyncActive) return 1;
+	if (!CardBusy) return 0;
+	
+	if (!StreamActive) CS_LOW();	// I en ben stream er kortet allerede valgt
+	if (SPI_receive() != 0x00) CardBusy = 0;
+	if (!StreamActive) { CS_HIGH(); SPI_transmit(0xFF); }
+	
+	return CardBusy;
+}
+
+// Venter til kortet er frdigt med alle skrivninger (bruges af CTRL_SYNC)
+// Returnerer 0, eller fejlkoden fra SD_busy_wait
+static uint8_t SD_wait_idle(void) {
+	uint8_t err;
+	if (SD_async_wait() != 0) return SD_ERR_ASYNC;
+	if (!CardBusy) return 0;
+	if (!StreamActive) CS_LOW();
+	err = SD_busy_wait();
+	if (!StreamActive) { CS_HIGH(); SPI_transmit(0xFF); }
+	return err;
+}
+
 // Bruges til at skrive n enkelte block (512b) til SD-kortet via SPI
 uint8_t SD_writeSingleBlock(uint32_t block, const uint8_t* buff) {
 	uint8_t response;
 	
+	SD_stream_end();	// ben stream skal afsluttes fr en ny kommando
+	
 	// CMD24 er kommandoen WRITE_SINGLE_BLOCK
-	response = SD_send_cmd(CMD24, block, 0x01);
+	response = SD_send_cmd(CMD24, SD_ADDR(block), 0x01);
 	
-	// Hvis svaret ikke er 0x00 afviste SD kommandoen, returner fejl 1
-	if (response != 0x00) { CS_HIGH(); return 1; }
+	// Hvis svaret ikke er 0x00 afviste SD kommandoen, returner fejl SD_ERR_CMD
+	if (response != 0x00) { CS_HIGH(); return SD_ERR_CMD; }
 		
 	// SPI transmitterer
 	SPI_transmit(0xFF);			// lead-in
-	SPI_transmit(0xFE);			// 'data-start' token
-	SPI_send_multi(buff, 512);	// Sender 512 bytes fra buff via SPI
-	SPI_transmit(0xFF);			// dummy CRC	
-	SPI_transmit(0xFF);			// dummy CRC
-	
-	// SD-kortet svarer p ovenstende med data response token
-	response = SPI_receive();
 	
-	// Kun hvis data token's laveste bits = 0x05 er 'data accepted'
-	if ((response & 0x1F) != 0x05) { CS_HIGH(); return 2; }
-		
-	// S lnge SD-kort sender 0x00 er det 'busy' --> skriver internt til dets flash
-	while (SPI_receive() == 0x00);
+	// Hvis data ikke blev accepteret, returner fejlen (SD_ERR_DATA)
+	uint8_t err = SD_send_data_block(0xFE, buff);
+	if (err) { CS_HIGH(); return err; }
 	
 	// Afslut med CS high og dummy bytes
 	CS_HIGH();
@@ -179,26 +633,239 @@ uint8_t SD_writeSingleBlock(uint32_t block, const uint8_t* buff) {
 }
 
 
+// Sender ACMD23 (SET_WR_BLK_ERASE_COUNT) fr en CMD25: kortet fr at vide hvor mange blokke der kommer
+// og kan slette dem p forhnd i stedet for n ad gangen --> kortere busy tid pr. blok
+// Virker kun for den nste CMD25. Stoppes den tidligt, er indholdet af de resterende blokke udefineret
+// Fejl ignoreres (det er kun et hint)
+static void SD_pre_erase(uint32_t count) {
+	if (count > 0x7FFFFF) count = 0x7FFFFF;		// 23 bit
+	SD_send_cmd(CMD55, 0, 0x65);
+	SD_send_cmd(ACMD23, count, 0x01);
+	CS_HIGH(); SPI_transmit(0xFF);
+}
+
+// Skriver 'count' blokke (512b) i trk til SD-kortet med CMD25 (WRITE_MULTIPLE_BLOCK)
+// Kommandoen sendes kun n gang, derefter sendes hver blok med sin egen 'data-start' token
+// Overfrslen afsluttes med 'stop-tran' token
+uint8_t SD_writeMultipleBlocks(uint32_t block, const uint8_t* buff, uint16_t count) {
+	uint8_t response;
+	
+	SD_stream_end();	// ben stream skal afsluttes fr en ny kommando
+	SD_pre_erase(count);
+	
+	// CMD25 er kommandoen WRITE_MULTIPLE_BLOCK
+	response = SD_send_cmd(CMD25, SD_ADDR(block), 0x01);
+	
+	// Hvis svaret ikke er 0x00 afviste SD kommandoen, returner fejl SD_ERR_CMD
+	if (response != 0x00) { CS_HIGH(); return SD_ERR_CMD; }
+	
+	SPI_transmit(0xFF);				// lead-in
+	
+	while (count--) {
+		// Hvis data ikke blev accepteret --> afbryd overfrslen og returner fejlen
+		uint8_t err = SD_send_data_block(0xFC, buff);
+		if (err) {
+			SD_stop_multiple_write();
+			return err;
+		}
+		buff += 512;
+	}
+	
+	SD_stop_multiple_write();
+	return 0;
+}
+
+
+// Srger for at der er en ben stream der starter ved 'block'
+// Returnerer 0 hvis kortet er klar til nste 'data-start' token, ellers en SD_ERR_xxx fejlkode
+static uint8_t SD_stream_open(uint32_t block) {
+	SD_async_wait();
+	if (StreamActive && (block != StreamNext || AsyncFailed)) SD_stream_end();
+	AsyncFailed = 0;
+	
+	if (!StreamActive) {
+		// Starter streamen inde i et annonceret omrde: resten af omrdet slettes p forhnd
+		if (block >= ExtentStart && block < ExtentEnd) SD_pre_erase(ExtentEnd - block);
+		if (SD_send_cmd(CMD25, SD_ADDR(block), 0x01) != 0x00) { CS_HIGH(); return SD_ERR_CMD; }
+		SPI_transmit(0xFF);			// lead-in
+		StreamActive = 1;
+	}
+	return 0;
+}
+
+// Stream: sektorer der skrives i rkkeflge sendes i n ben CMD25 uden 'stop-tran' imellem
+// Bruges til logning direkte til et forhndsallokeret omrde p kortet
+// Skriver n blok (512b) i den bne stream
+// Hvis 'block' ikke flger efter forrige blok (eller ingen stream er ben) startes en ny CMD25
+uint8_t SD_stream_write(uint32_t block, const uint8_t* buff) {
+	uint8_t err = SD_stream_open(block);
+	if (err) return err;
+	
+	err = SD_send_data_block(0xFC, buff);
+	if (err) {
+		SD_stream_end();
+		return err;
+	}
+	
+	StreamNext = block + 1;
+	return 0;
+}
+
+// Som SD_stream_write, men blokkens 512 bytes sendes i baggrunden af SPI_STC_vect,
+// s hovedlkken kan regne RMS og tegne imens. Funktionen returnerer efter 'data-start' token.
+// 'buff' m ikke ndres fr 'done' er kaldt (fra interruptet, med 0 = data accepted, 1 = fejl).
+// Imens venter alle andre SD funktioner p at overfrslen er frdig (SD_async_wait).
+//
+// Overfrslen krer ved SD_ASYNC_SPEED: ved 8 MHz tager n byte kun 16 cykler, mindre end selve
+// interruptet (ca. 45 cykler), s der ville ikke vre tid tilbage til hovedlkken.
+// Ved 1 MHz (128 cykler pr. byte) er ca. 2/3 af CPU-tiden fri, og n sektor tager ca. 4,2 ms.
+// Interruptet er kort, s ADC interruptet hjst forsinkes nogle f us (ADC'en krer free running,
+// s selve sample-tidspunktet pvirkes ikke).
+uint8_t SD_stream_write_async(uint32_t block, const uint8_t* buff, SD_async_callback done) {
+	uint8_t speed = (SpiSpeed > SD_ASYNC_SPEED) ? SpiSpeed : SD_ASYNC_SPEED;
+	uint8_t err = SD_stream_open(block);
+	if (err) return err;
+	
+	err = SD_busy_wait();		// Forrige blok skal vre skrevet frdig fr nste token
+	if (err) {
+		SD_stream_end();
+		return err;
+	}
+	SPI_transmit(0xFC);			// 'data-start' token (multi-block)
+	
+	AsyncBuf    = buff;
+	AsyncCount  = 1;
+	AsyncCrc    = CRC16_UPDATE(0, buff[0]);
+	AsyncDone   = done;
+	AsyncActive = 1;
+	StreamNext  = block + 1;
+	
+	SPSR = SpiSpeeds[speed].spsr;
+	SPCR = SpiSpeeds[speed].spcr | (1<<SPIE);	// SPI interrupt til
+	SPDR = buff[0];								// Frste byte, resten sendes fra interruptet
+	return 0;
+}
+
+// n byte frdig: start den nste. Byte 0-511 er data, s 2 CRC bytes og n byte
+// til at hente kortets 'data response'. Til sidst sls interruptet fra og hastigheden sttes tilbage.
+// CRC16 opdateres efter hver byte er startet (ca. 20 cykler, der er 128 cykler pr. byte ved 1 MHz)
+ISR(SPI_STC_vect) {
+	uint16_t n = AsyncCount;
+	
+	if (n < 512) {
+		uint8_t b = AsyncBuf[n];
+		SPDR = b;
+		AsyncCrc = CRC16_UPDATE(AsyncCrc, b);
+	} else if (n == 512) {
+		SPDR = CrcEnabled ? (uint8_t)(AsyncCrc >> 8) : 0xFF;
+	} else if (n == 513) {
+		SPDR = CrcEnabled ? (uint8_t)AsyncCrc : 0xFF;
+	} else if (n == 514) {
+		SPDR = 0xFF;
+	} else {
+		uint8_t response = SPDR & 0x1F;
+		uint8_t status = (response == 0x05) ? 0 : 1;
+		if (response == 0x0B) Errors.crc++;
+		else if (status) Errors.data++;
+		SPCR = SpiSpeeds[SpiSpeed].spcr;		// SPIE fra
+		SPSR = SpiSpeeds[SpiSpeed].spsr;
+		CardBusy    = 1;
+		AsyncFailed = status;
+		AsyncActive = 0;
+		if (AsyncDone) AsyncDone(status);
+		return;
+	}
+	AsyncCount = n + 1;
+}
+
+// Afslutter den bne stream (gr intet hvis ingen stream er ben)
+void SD_stream_end(void) {
+	SD_async_wait();
+	if (!StreamActive) return;
+	StreamActive = 0;
+	SD_stop_multiple_write();
+}
+
+
 uint8_t SD_readSingleBlock(uint32_t block, uint8_t* buff) {
 	uint8_t response;
-	uint16_t i;
-	response = SD_send_cmd(CMD17, block, 0x01);
-	if (response != 0x00) { CS_HIGH(); return 1; }
-	for (i = 0; i < 0xFFFF; i++) {
-		response = SPI_receive();
-		if (response == 0xFE) break;
+	SD_stream_end();
+	response = SD_send_cmd(CMD17, SD_ADDR(block), 0x01);
+	if (response != 0x00) { CS_HIGH(); return SD_ERR_CMD; }
+	
+	// Hvis vi ikke modtager start token --> return fejl SD_ERR_TOKEN (SD_ERR_CRC hvis data var delagt)
+	uint8_t err = SD_receive_data_block(buff, 512);
+	if (err) { CS_HIGH(); return err; }
+	
+	CS_HIGH();
+	SPI_transmit(0xFF);
+	return 0;
+}
+
+// Lser 'count' blokke (512b) i trk med CMD18 (READ_MULTIPLE_BLOCK)
+// Kortet sender blokkene efter hinanden indtil det stoppes med CMD12 (STOP_TRANSMISSION)
+uint8_t SD_readMultipleBlocks(uint32_t block, uint8_t* buff, uint16_t count) {
+	uint8_t response;
+	SD_stream_end();
+	response = SD_send_cmd(CMD18, SD_ADDR(block), 0x01);
+	if (response != 0x00) { CS_HIGH(); return SD_ERR_CMD; }
+	
+	uint8_t rx_err = 0;
+	while (count) {
+		rx_err = SD_receive_data_block(buff, 512);
+		if (rx_err) break;									// Manglende start token / CRC fejl --> stop og returner fejl
+		buff += 512;
+		count--;
 	}
 	
-	// Hvis vi ikke modtager start token --> return fejl 2
-	if (response != 0xFE) { CS_HIGH(); return 2; }
-		
-	// Ls 512 bytes fra SD kort og gem i buff
-	for (i = 0; i < 512; i++) buff[i] = SPI_receive();
+	// Stop overfrslen --> kortet svarer med R1b (busy indtil det er klar)
+	SD_send_cmd(CMD12, 0, 0x01);
+	CardBusy = 1;
+	uint8_t err = SD_busy_wait();
 	
-	SPI_receive();
-	SPI_receive();
 	CS_HIGH();
 	SPI_transmit(0xFF);
+	
+	// Hvis ikke alle blokke blev modtaget --> return fejlen (SD_ERR_TOKEN / SD_ERR_CRC)
+	if (count) return rx_err;
+	return err;
+}
+
+// Slr CRC til (1) eller fra (0) p kortet med CMD59 (CRC_ON_OFF)
+// Returnerer 0 hvis kortet accepterede kommandoen
+uint8_t SD_set_crc(uint8_t enable) {
+	SD_stream_end();
+	uint8_t response = SD_send_cmd(CMD59, enable ? 1 : 0, 0x01);
+	CS_HIGH(); SPI_transmit(0xFF);
+	
+	if (response & 0xFE) return 1;	// 0x00 (klar) og 0x01 (idle, under init) er OK
+	CrcEnabled = enable ? 1 : 0;
+	return 0;
+}
+
+uint8_t SD_get_crc(void) {
+	return CrcEnabled;
+}
+
+// Hurtigt tjek af at kortet stadig sidder i og svarer (CMD13 SEND_STATUS, R2 svar = R1 + status byte)
+// Bruges i stedet for en fuld re-mount. Ved fejl markeres kortet som ikke initialiseret,
+// s FatFs krer SD_init() igen ved nste f_mount / fil-adgang
+// Returnerer 0 hvis kortet er klar, ellers 1
+uint8_t SD_check(void) {
+	uint8_t r1, r2;
+	if (Stat & STA_NOINIT) return 1;
+	
+	SD_stream_end();
+	r1 = SD_send_cmd(CMD13, 0, 0x01);
+	r2 = SPI_receive();
+	CS_HIGH();
+	SPI_transmit(0xFF);
+	
+	// Intet kort: MISO lses som 0xFF. Nyt kort: ikke i SPI mode endnu --> svarer heller ikke
+	if (r1 != 0x00 || r2 != 0x00) {
+		Stat |= STA_NOINIT;
+		return 1;
+	}
 	return 0;
 }
 
@@ -220,34 +887,57 @@ DRESULT disk_read(BYTE pdrv, BYTE* buff, LBA_t sector, UINT count) {
 	if (pdrv != DEV_MMC) return RES_PARERR;
 	if (count == 0) return RES_PARERR;
 	if (Stat & STA_NOINIT) return RES_NOTRDY;
-	for (UINT i = 0; i < count; i++) {
-		if (SD_readSingleBlock(sector + i, buff + 512 * i) != 0) {
-			return RES_ERROR;
-		}
-	}
-	return RES_OK;
+	
+	// n sektor: CMD17, flere sektorer: n CMD18 + CMD12 for hele rkken
+	// Ved fejl prves igen ved lavere SPI hastighed
+	uint8_t result;
+	do {
+		result = (count == 1) ? SD_readSingleBlock(sector, buff) : SD_readMultipleBlocks(sector, buff, count);
+	} while (result != 0 && SD_speed_fallback());
+	
+	return (result == 0) ? RES_OK : RES_ERROR;
 }
 DRESULT disk_write(BYTE pdrv, const BYTE* buff, LBA_t sector, UINT count) {
 	if (pdrv != DEV_MMC) return RES_PARERR;
 	if (count == 0) return RES_PARERR;
 	if (Stat & STA_NOINIT) return RES_NOTRDY;
-	for (UINT i = 0; i < count; i++) {
-		if (SD_writeSingleBlock(sector + i, buff + 512 * i) != 0) {
-			return RES_ERROR;
-		}
-	}
-	return RES_OK;
+	
+	// n sektor: CMD24, flere sektorer: n CMD25 for hele rkken
+	// Ved fejl prves igen ved lavere SPI hastighed
+	uint8_t result;
+	do {
+		result = (count == 1) ? SD_writeSingleBlock(sector, buff) : SD_writeMultipleBlocks(sector, buff, count);
+	} while (result != 0 && SD_speed_fallback());
+	
+	return (result == 0) ? RES_OK : RES_ERROR;
 }
 DRESULT disk_ioctl(BYTE pdrv, BYTE cmd, void* buff) {
 	if (pdrv != DEV_MMC) return RES_PARERR;
 	switch (cmd) {
-		case CTRL_SYNC: *(BYTE*)buff = 0; return RES_OK;
+		case CTRL_SYNC: SD_stream_end(); return (SD_wait_idle() == 0) ? RES_OK : RES_ERROR;
 		case GET_SECTOR_SIZE: *(WORD*)buff = 512; return RES_OK;
 		case GET_BLOCK_SIZE: *(DWORD*)buff = 1; return RES_OK;
-		case GET_SECTOR_COUNT: *(DWORD*)buff = 32768; return RES_OK;
+		case GET_SECTOR_COUNT:
+			if (Stat & STA_NOINIT) return RES_NOTRDY;
+			*(DWORD*)buff = CardSectors;
+			return RES_OK;
+		case MMC_GET_TYPE: *(BYTE*)buff = CardType; return RES_OK;
+		case MMC_GET_CSD: memcpy(buff, CardCsd, sizeof(CardCsd)); return RES_OK;
+		case MMC_GET_OCR: memcpy(buff, CardOcr, sizeof(CardOcr)); return RES_OK;
+		case MMC_SET_WRITE_EXTENT:
+			// Bruges af SD_stream_open til ACMD23 nr streamen starter (eller genstartes) i omrdet
+			if (buff) {
+				ExtentStart = ((LBA_t*)buff)[0];
+				ExtentEnd   = ((LBA_t*)buff)[1] + 1;
+			} else {
+				ExtentStart = ExtentEnd = 0;
+			}
+			return RES_OK;
 		default: return RES_PARERR;
 	}
 }
+
+// Tidsstempel til filer: intet RTC, s uret starter ved firmwarens build-tid og tller med 1 ms tick (Timer_FatTime)
 DWORD get_fattime(void) {
-	return ((2020UL - 1980UL) << 25) | (1UL << 21) | (1UL << 16);
+	return Timer_FatTime();
 }
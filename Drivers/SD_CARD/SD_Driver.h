@@ -4,16 +4,84 @@
 #include <stdint.h>
 #include "diskio.h"
 
+// Korttype (MMC_GET_TYPE)
+#define CT_SD1    0x02	// SD version 1 (SDSC)
+#define CT_SD2    0x04	// SD version 2 (SDSC eller SDHC/SDXC)
+#define CT_BLOCK  0x08	// Blok-adressering (SDHC/SDXC)
+
+// SPI hastigheder efter init (SD_set_speed / SD_get_speed)
+#define SD_SPEED_8MHZ   0
+#define SD_SPEED_4MHZ   1
+#define SD_SPEED_2MHZ   2
+#define SD_SPEED_1MHZ   3
+#define SD_SPEED_COUNT  4
+
+// Fejlkoder fra lse/skrive funktionerne (0 = OK)
+#define SD_ERR_CMD     1	// Kommando afvist eller intet R1 svar
+#define SD_ERR_DATA    2	// Datablok afvist af kortet ('data response' != accepted)
+#define SD_ERR_TOKEN   3	// Timeout: 'data-start' token kom ikke (lsning)
+#define SD_ERR_BUSY    4	// Timeout: kortet blev ved med at vre busy efter en skrivning
+#define SD_ERR_ASYNC   5	// Timeout: baggrunds-overfrslen blev ikke frdig
+#define SD_ERR_CRC     6	// CRC fejl p en datablok (lst eller afvist af kortet)
+
+// CRC beskyttelse af kommandoer (CRC7) og datablokke (CRC16), sls til med CMD59 i SD_init.
+// Fejl p SPI-bussen ved hj hastighed opdages og blokken prves igen ved lavere hastighed (disk_read/disk_write).
+// 1 = til, 0 = fra (kan ogs skiftes med SD_set_crc). SD_Bench mler hvad det koster.
+#define SD_USE_CRC     1
+
+// Timeouts (ms, mlt med Timer_Millis --> Timer_Init() skal vre kaldt). Alle ventetider i driveren er begrnset,
+// s worst case for et kald er summen af de timeouts det kan ramme. F.eks. n log-sektor med
+// SD_stream_write_async, nr streamen genstartes inde i et annonceret omrde (MMC_SET_WRITE_EXTENT):
+// ASYNC (forrige sektor) + BUSY (fr 'stop-tran') + BUSY (CMD55) + BUSY (ACMD23, SD_pre_erase) + BUSY (CMD25)
+// + BUSY (fr token) = ca. 2,5 s. Uden genstart er det kun ASYNC + BUSY (fr token) = ca. 0,5 s
+#define SD_TIMEOUT_READ_MS    100	// SD spec: lsning max 100 ms
+#define SD_TIMEOUT_BUSY_MS    500	// SD spec: skrivning max 250 ms (SDHC) / 500 ms (SDXC)
+#define SD_TIMEOUT_ASYNC_MS   20	// n sektor ved SD_ASYNC_SPEED tager ca. 4,2 ms
+#define SD_TIMEOUT_INIT_MS    1000	// ACMD41 initialisering
+
+// Fejltllere siden opstart (SD_get_errors)
+typedef struct {
+	uint16_t cmd;		// Intet R1 svar
+	uint16_t data;		// Datablokke afvist
+	uint16_t token;		// Timeout p 'data-start' token
+	uint16_t busy;		// Timeout mens kortet var busy
+	uint16_t async;		// Afbrudte baggrunds-overfrsler
+	uint16_t crc;		// CRC fejl (lsning og skrivning)
+} SdErrorCounters;
+
+// SPI hastighed for baggrunds-overfrsler (SD_stream_write_async), se SD_Driver.c
+#define SD_ASYNC_SPEED  SD_SPEED_1MHZ
+
+// Kaldes fra SPI interruptet nr en baggrunds-blok er frdig (status 0 = data accepted, 1 = fejl)
+typedef void (*SD_async_callback)(uint8_t status);
+
 void SPI_init(void);
 uint8_t SPI_transmit(uint8_t data);
 uint8_t SPI_receive(void);
 void SPI_send_multi(const uint8_t* data, uint16_t len);
 void SPI_receive_multi(uint8_t* data, uint16_t len);
+void SPI_send_sector(const uint8_t* data);
+void SPI_receive_sector(uint8_t* data);
+uint16_t SPI_send_sector_crc(const uint8_t* data);
+uint16_t SPI_receive_sector_crc(uint8_t* data);
+void SD_set_speed(uint8_t speed);
+uint8_t SD_get_speed(void);
 
 uint8_t SD_send_cmd(uint8_t cmd, uint32_t arg, uint8_t crc);
 uint8_t SD_init(void);
+uint8_t SD_check(void);
+uint8_t SD_set_crc(uint8_t enable);
+uint8_t SD_get_crc(void);
 uint8_t SD_writeSingleBlock(uint32_t block, const uint8_t* buff);
+uint8_t SD_writeMultipleBlocks(uint32_t block, const uint8_t* buff, uint16_t count);
 uint8_t SD_readSingleBlock(uint32_t block, uint8_t* buff);
+uint8_t SD_stream_write(uint32_t block, const uint8_t* buff);
+void SD_stream_end(void);
+uint8_t SD_stream_write_async(uint32_t block, const uint8_t* buff, SD_async_callback done);
+uint8_t SD_async_wait(void);
+void SD_get_errors(SdErrorCounters* out);
+uint8_t SD_poll_busy(void);
+uint8_t SD_readMultipleBlocks(uint32_t block, uint8_t* buff, uint16_t count);
 
 DSTATUS disk_status(BYTE pdrv);
 DSTATUS disk_initialize(BYTE pdrv);
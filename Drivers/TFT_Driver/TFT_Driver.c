@@ -282,6 +282,20 @@ void BackgroundColor(uint8_t Red, uint8_t Green, uint8_t Blue)
 	}
 }
 
+void FillRectangle(uint16_t StartX, uint16_t StartY, uint16_t Width, uint16_t Height, uint8_t Red, uint8_t Green, uint8_t Blue)
+{
+	uint16_t color = (Red << 11) | (Green << 5) | Blue;
+
+	SetColumnAddress(StartX, StartX + Width - 1);
+	SetPageAddress(StartY, StartY + Height - 1);
+	WriteCommand(0x2C);  // Memory Write
+
+	for (uint32_t i = 0; i < (uint32_t)Width * Height; i++)
+	{
+		WriteData(color);
+	}
+}
+
 void DrawVerticalLine(uint16_t x, uint16_t y_start, uint16_t y_end, uint8_t Red, uint8_t Green, uint8_t Blue)
 {
 	SetColumnAddress(x, x);
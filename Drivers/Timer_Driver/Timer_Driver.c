@@ -0,0 +1,84 @@
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <stdlib.h>
+#include <string.h>
+#include "Timer_Driver.h"
+
+volatile uint32_t timer_ms_count = 0;	// Milliseconds since start (updated in Timer3 interrupt)
+
+// Initializes Timer3 in CTC mode with a 1 ms period
+void Timer_Init(void) {
+	TCCR3A = 0;
+	TCCR3B = (1 << WGM32) | (1 << CS31) | (1 << CS30);	// CTC mode, prescaler = 64 (16MHz / 64 = 250 kHz => 4 us per tick)
+	OCR3A  = 249;										// 250 ticks = 1 ms
+	TIMSK3 |= (1 << OCIE3A);							// Enable compare match interrupt
+}
+
+// ISR for Timer3 (kept short so it adds as little latency as possible to the ADC interrupt)
+ISR(TIMER3_COMPA_vect) {
+	timer_ms_count++;
+}
+
+uint32_t Timer_Millis(void) {
+	uint32_t ms;
+	uint8_t sreg = SREG;	// Save interrupt state
+	cli();					// 32-bit read is not atomic on AVR
+	ms = timer_ms_count;
+	SREG = sreg;			// Restore interrupt state
+	return ms;
+}
+
+uint32_t Timer_Micros(void) {
+	uint32_t ms;
+	uint16_t ticks;
+	uint8_t sreg = SREG;
+	cli();
+	ms    = timer_ms_count;
+	ticks = TCNT3;
+	if ((TIFR3 & (1 << OCF3A)) && ticks < 125) ms++;	// Compare match happened but ISR has not run yet
+	SREG = sreg;
+	return ms * 1000UL + (uint32_t)ticks * 4;
+}
+
+// Days in 'month' (1-12) of 'year'
+static uint8_t days_in_month(uint16_t year, uint8_t month) {
+	static const uint8_t days[12] = { 31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31 };
+	if (month == 2 && (year % 4 == 0) && (year % 100 != 0 || year % 400 == 0)) return 29;
+	return days[month - 1];
+}
+
+// There is no RTC, so the clock starts at the build time of this file (__DATE__ "Mmm dd yyyy", __TIME__ "hh:mm:ss")
+// and runs from the 1 ms tick. File times are therefore in the right order and close to the real time
+// when the firmware was flashed recently.
+uint32_t Timer_FatTime(void) {
+	static const char months[] = "JanFebMarAprMayJunJulAugSepOctNovDec";
+	const char* date = __DATE__;
+	const char* time = __TIME__;
+	
+	uint16_t year  = atoi(date + 7);
+	uint8_t  month = 1;
+	while (month < 12 && strncmp(&months[(month - 1) * 3], date, 3) != 0) month++;
+	uint8_t  day   = atoi(date + 4);
+	
+	uint32_t seconds = atol(time) * 3600UL + atoi(time + 3) * 60UL + atoi(time + 6) + Timer_Millis() / 1000UL;
+	
+	// Whole days of uptime move the date forward
+	uint32_t days = seconds / 86400UL;
+	seconds %= 86400UL;
+	while (days--) {
+		if (++day > days_in_month(year, month)) {
+			day = 1;
+			if (++month > 12) {
+				month = 1;
+				year++;
+			}
+		}
+	}
+	
+	uint8_t hour   = seconds / 3600UL;
+	uint8_t minute = (seconds / 60UL) % 60;
+	uint8_t second = seconds % 60;
+	
+	return ((uint32_t)(year - 1980) << 25) | ((uint32_t)month << 21) | ((uint32_t)day << 16)
+	     | ((uint32_t)hour << 11) | ((uint32_t)minute << 5) | (second / 2);
+}
@@ -0,0 +1,25 @@
+#ifndef TIMER_DRIVER_H_
+#define TIMER_DRIVER_H_
+
+#include <stdint.h>
+
+// Starts Timer3 as a 1 kHz system tick (enable global interrupts with sei() afterwards)
+void Timer_Init(void);
+
+// Milliseconds since Timer_Init() (wraps after ~49 days)
+uint32_t Timer_Millis(void);
+
+// Microseconds since Timer_Init() with 4 us resolution (wraps after ~71 minutes)
+uint32_t Timer_Micros(void);
+
+// Milliseconds since Timer_Init(), for interrupt handlers only (interrupts are already disabled there,
+// and no function call is needed, so the calling ISR does not have to save extra registers)
+extern volatile uint32_t timer_ms_count;
+static inline uint32_t Timer_MillisFromISR(void) {
+	return timer_ms_count;
+}
+
+// Date and time in FAT format (used by get_fattime): build time of the firmware + time since Timer_Init()
+uint32_t Timer_FatTime(void);
+
+#endif /* TIMER_DRIVER_H_ */
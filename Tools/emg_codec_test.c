@@ -0,0 +1,114 @@
+/* Host round-trip test for Drivers/Logger/EMG_Codec.c (Pack10 and the Rice block coder).
+ *
+ * Build and run on a PC from the repository root:
+ *     gcc -std=gnu99 -Wall -I Drivers/Logger Tools/emg_codec_test.c Drivers/Logger/EMG_Codec.c -o emg_codec_test
+ *     ./emg_codec_test
+ *
+ * Exits with 0 when every block decodes to exactly the samples it was coded from.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "EMG_Codec.h"
+
+#define WINDOW        480		// BUFFER_SIZE in main.c
+#define RANDOM_BLOCKS 5000
+
+static uint16_t samples[WINDOW];
+static uint8_t  packed[PACK10_BYTES(WINDOW)];
+static uint8_t  decoded[PACK10_BYTES(WINDOW)];
+static uint8_t  block[RICE_BLOCK_MAX_BYTES(WINDOW)];
+static int      failures = 0;
+
+// Packs samples[], codes and decodes the block and compares. 'expect_k' < 0: any k is accepted.
+static void round_trip(const char* name, int expect_k) {
+	for (int g = 0; g < WINDOW; g += PACK10_GROUP_SAMPLES) {
+		Pack10_Pack4(&samples[g], &packed[g / PACK10_GROUP_SAMPLES * PACK10_GROUP_BYTES]);
+	}
+	for (int i = 0; i < WINDOW; i++) {
+		if (Pack10_Get(packed, i) != samples[i]) {
+			printf("FAIL %s: Pack10_Get(%d) = %u, expected %u\n", name, i, Pack10_Get(packed, i), samples[i]);
+			failures++;
+			return;
+		}
+	}
+
+	uint16_t bytes = Rice_EncodeBlock(packed, WINDOW, block);
+	uint16_t size  = block[1] | (block[2] << 8);
+
+	if (bytes > RICE_BLOCK_MAX_BYTES(WINDOW) || bytes != RICE_BLOCK_HEADER + size) {
+		printf("FAIL %s: block size %u (payload %u)\n", name, bytes, size);
+		failures++;
+		return;
+	}
+	if (expect_k >= 0 && block[0] != expect_k) {
+		printf("FAIL %s: k = %u, expected %d\n", name, block[0], expect_k);
+		failures++;
+		return;
+	}
+	memset(decoded, 0xAA, sizeof(decoded));
+	if (Rice_DecodeBlock(block, WINDOW, decoded) != 0 || memcmp(packed, decoded, sizeof(packed)) != 0) {
+		printf("FAIL %s: decoded samples differ (k = %u)\n", name, block[0]);
+		failures++;
+	}
+}
+
+int main(void) {
+	// Pack10: every 10-bit value in every lane
+	for (int v = 0; v < 1024; v++) {
+		uint16_t in[4] = { v, 1023 - v, v ^ 0x2AA, (v * 7) & 1023 }, out[4];
+		uint8_t group[PACK10_GROUP_BYTES];
+		Pack10_Pack4(in, group);
+		Pack10_Unpack4(group, out);
+		if (memcmp(in, out, sizeof(in)) != 0) {
+			printf("FAIL Pack10 value %d\n", v);
+			failures++;
+		}
+	}
+
+	// Constant input: all deltas are 0 -> k = 0
+	for (int v = 0; v <= 1023; v += 1023) {
+		for (int i = 0; i < WINDOW; i++) samples[i] = v;
+		round_trip("constant", 0);
+	}
+
+	// Full-scale steps 0 <-> 1023: larger coded than packed -> stored fallback
+	for (int i = 0; i < WINDOW; i++) samples[i] = (i & 1) ? 1023 : 0;
+	round_trip("full-scale steps", RICE_STORED);
+
+	// White noise over the full range: stored fallback
+	srand(1);
+	for (int i = 0; i < WINDOW; i++) samples[i] = rand() % 1024;
+	round_trip("full-range noise", RICE_STORED);
+
+	// Single step from 0 to 1023 in an otherwise flat block
+	for (int i = 0; i < WINDOW; i++) samples[i] = (i < WINDOW / 2) ? 0 : 1023;
+	round_trip("single step", -1);
+
+	// Random walks with step sizes from 1 to full scale (EMG-like signals up to noise)
+	for (int b = 0; b < RANDOM_BLOCKS; b++) {
+		int amp = 1 << (b % 11);
+		int v = rand() % 1024;
+		for (int i = 0; i < WINDOW; i++) {
+			v += rand() % (amp + 1) - amp / 2;
+			if (v < 0) v = 0;
+			if (v > 1023) v = 1023;
+			samples[i] = v;
+		}
+		round_trip("random walk", -1);
+	}
+
+	// Corrupt blocks must be rejected, not decoded out of bounds
+	for (int i = 0; i < WINDOW; i++) samples[i] = 512 + (i % 3);
+	round_trip("small deltas", -1);
+	block[1] = 1;
+	block[2] = 0;	// Payload cut to one byte
+	if (Rice_DecodeBlock(block, WINDOW, decoded) == 0) {
+		printf("FAIL truncated block was accepted\n");
+		failures++;
+	}
+
+	printf("%s: %d failures\n", failures ? "FAILED" : "OK", failures);
+	return failures ? 1 : 0;
+}
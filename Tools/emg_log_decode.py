@@ -0,0 +1,270 @@
+#!/usr/bin/env python3
+"""Decode EMG log files (EMGnnn.BIN) written by the firmware.
+
+Usage:
+    python3 emg_log_decode.py EMG000.BIN            # CSV to stdout
+    python3 emg_log_decode.py EMG000.BIN -o out.csv
+    python3 emg_log_decode.py EMG000.BIN --info     # header and session statistics only
+
+The file format is defined in Drivers/Logger/Logger.h.
+"""
+
+import argparse
+import struct
+import sys
+
+MAGIC = b"EMGL"
+TRAILER_MAGIC = b"EMGT"
+SUPPORTED_VERSIONS = (1, 2, 3, 4, 5)
+
+RECORD_RMS = 1
+RECORD_RAW = 2
+RECORD_RAW10 = 3
+RECORD_RICE = 4
+
+RICE_STORED = 0xFF
+RICE_BLOCK = struct.Struct("<BH")   # k, payload bytes
+TIMESTAMP = struct.Struct("<I")     # Timer_Millis() at the last sample of the window (version 3+)
+RICE_MAX_K = 10
+MAX_GAP_MS = 60000                  # Larger steps between windows are not records (same rule as Drivers/Logger/Replay.c)
+THRESHOLD_MARK = 0xFFFFFFFE         # Timestamp of a threshold record (version 5+)
+THRESHOLD = struct.Struct("<H")     # New threshold, scaled like threshold_mv
+
+# magic, version, header_size, record_type, reserved,
+# sample_rate_hz, window_size, vref_mv, threshold_mv, rms_scale
+HEADER = struct.Struct("<4sBBBBHHHHH")
+HEADER_START_TIME = struct.Struct("<I")     # Follows HEADER (version 4+), FAT date/time
+
+# magic, windows, samples, dropped_windows, duration_ms, bytes (version 2-3)
+TRAILER = struct.Struct("<4sIIIII")
+TRAILER_FIELDS = ("windows", "samples", "dropped_windows", "duration_ms", "bytes")
+# ... rms_min, rms_max, rms_mean, sectors, write_max_us, write_total_ms (version 4+)
+TRAILER_V4 = struct.Struct("<4sIIIIIHHHIII")
+TRAILER_V4_FIELDS = TRAILER_FIELDS + ("rms_min", "rms_max", "rms_mean", "sectors", "write_max_us", "write_total_ms")
+
+
+def fat_time(value):
+    """Formats a FAT date/time (get_fattime) as 'YYYY-MM-DD hh:mm:ss'."""
+    return "%04d-%02d-%02d %02d:%02d:%02d" % (
+        1980 + (value >> 25), (value >> 21) & 0x0F, (value >> 16) & 0x1F,
+        (value >> 11) & 0x1F, (value >> 5) & 0x3F, (value & 0x1F) * 2)
+
+
+def read_header(data):
+    if len(data) < HEADER.size:
+        raise ValueError("file too short for header")
+    (magic, version, header_size, record_type, _reserved,
+     sample_rate, window_size, vref, threshold, rms_scale) = HEADER.unpack_from(data)
+    if magic != MAGIC:
+        raise ValueError("not an EMG log file (bad magic %r)" % magic)
+    if version not in SUPPORTED_VERSIONS:
+        raise ValueError("unsupported log version %d" % version)
+    header = {
+        "version": version,
+        "header_size": header_size,
+        "record_type": record_type,
+        "sample_rate_hz": sample_rate,
+        "window_size": window_size,
+        "vref_mv": vref,
+        "threshold_mv": threshold,
+        "rms_scale": rms_scale,
+    }
+    if version >= 4:
+        (header["start_time"],) = HEADER_START_TIME.unpack_from(data, HEADER.size)
+    return header
+
+
+def read_trailer(data, header):
+    """Returns (stats dict or None, end offset of the records)."""
+    trailer, names = (TRAILER_V4, TRAILER_V4_FIELDS) if header["version"] >= 4 else (TRAILER, TRAILER_FIELDS)
+    if header["version"] >= 2 and len(data) >= header["header_size"] + trailer.size:
+        fields = trailer.unpack_from(data, len(data) - trailer.size)
+        if fields[0] == TRAILER_MAGIC:
+            return dict(zip(names, fields[1:])), len(data) - trailer.size
+    return None, len(data)     # Version 1, or the session was not stopped cleanly
+
+
+def unpack10(body):
+    """Unpacks 10-bit samples stored 4 per 5 bytes (see Drivers/Logger/EMG_Codec.h)."""
+    samples = []
+    for g in range(0, len(body) - 4, 5):
+        high = body[g + 4]
+        for lane in range(4):
+            samples.append(body[g + lane] | (((high >> (2 * lane)) & 0x03) << 8))
+    return samples
+
+
+class CorruptBlock(Exception):
+    """A coded block that cannot have been written by the firmware."""
+
+
+def rice_decode(payload, k, count):
+    """Decodes one Rice coded block: a 10-bit first sample, then zigzag deltas."""
+    bits = "".join(format(b, "08b") for b in payload)
+    if len(bits) < 10:
+        raise CorruptBlock("block too short")
+    pos = 10
+    samples = [int(bits[:10], 2)]
+    while len(samples) < count:
+        q = 0
+        while pos < len(bits) and bits[pos] == "1":
+            q += 1
+            pos += 1
+        pos += 1
+        if pos + k > len(bits):
+            raise CorruptBlock("block too short")
+        zz = (q << k) | (int(bits[pos:pos + k], 2) if k else 0)
+        pos += k
+        delta = (zz >> 1) ^ -(zz & 1)
+        sample = samples[-1] + delta
+        if not 0 <= sample <= 1023:
+            raise CorruptBlock("sample out of range")
+        samples.append(sample)
+    return samples
+
+
+def decode_windows(data, header, end):
+    """Returns a list of (timestamp_ms, values, threshold) per window. timestamp_ms is None before version 3.
+    threshold is the activation threshold the window was decided with (scaled like threshold_mv): the header
+    value, changed by threshold records (version 5+).
+
+    Without a trailer (session not stopped cleanly) the file may still have its preallocated size with stale
+    data behind the records. Decoding then stops at the first record that cannot be valid: a timestamp going
+    backwards or jumping ahead by more than MAX_GAP_MS, or a corrupt coded block.
+    """
+    record_type = header["record_type"]
+    window_size = header["window_size"]
+    stored = window_size // 4 * 5
+    pos = header["header_size"]
+    last = None
+    threshold = header["threshold_mv"]
+    threshold_max = header["vref_mv"] * header["rms_scale"]
+    windows = []
+    while True:
+        timestamp = None
+        if header["version"] >= 3:
+            if pos + TIMESTAMP.size > end:
+                break
+            (timestamp,) = TIMESTAMP.unpack_from(data, pos)
+            if header["version"] >= 5 and timestamp == THRESHOLD_MARK:
+                if pos + TIMESTAMP.size + THRESHOLD.size > end:
+                    break
+                (value,) = THRESHOLD.unpack_from(data, pos + TIMESTAMP.size)
+                if value > threshold_max:
+                    break       # Not a record (erased sectors read as 0xFF)
+                threshold = value
+                pos += TIMESTAMP.size + THRESHOLD.size
+                continue
+            if last is not None and not last <= timestamp <= last + MAX_GAP_MS:
+                break
+            last = timestamp
+            pos += TIMESTAMP.size
+        k = None
+        if record_type == RECORD_RMS:
+            size = 2
+        elif record_type == RECORD_RAW:
+            size = 2 * window_size
+        elif record_type == RECORD_RAW10:
+            size = stored
+        elif record_type == RECORD_RICE:
+            if pos + RICE_BLOCK.size > end:
+                break
+            k, size = RICE_BLOCK.unpack_from(data, pos)
+            if size > stored or (k == RICE_STORED and size != stored) or (k != RICE_STORED and k > RICE_MAX_K):
+                break           # Not a block written by Rice_EncodeBlock()
+            pos += RICE_BLOCK.size
+        else:
+            raise ValueError("unknown record type %d" % record_type)
+        if pos + size > end:
+            break               # Record cut off (session not stopped cleanly)
+        body = data[pos:pos + size]
+        pos += size
+
+        if record_type in (RECORD_RMS, RECORD_RAW):
+            values = struct.unpack("<%dH" % (size // 2), body)
+        elif k is None or k == RICE_STORED:
+            values = unpack10(body)
+        else:
+            try:
+                values = rice_decode(body, k, window_size)
+            except CorruptBlock:
+                break
+        windows.append((timestamp, values, threshold))
+    return windows
+
+
+def print_stats(stats, out):
+    for key, value in stats.items():
+        out.write("%s: %s\n" % (key, value))
+    if stats["duration_ms"]:
+        out.write("throughput_bytes_per_s: %.0f\n" % (stats["bytes"] * 1000.0 / stats["duration_ms"]))
+    if stats.get("sectors"):
+        out.write("write_mean_us: %.0f\n" % (stats["write_total_ms"] * 1000.0 / stats["sectors"]))
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("file")
+    parser.add_argument("-o", "--output", help="CSV output file (default: stdout)")
+    parser.add_argument("--info", action="store_true", help="print the header and exit")
+    args = parser.parse_args()
+
+    with open(args.file, "rb") as f:
+        data = f.read()
+    header = read_header(data)
+    stats, end = read_trailer(data, header)
+
+    if args.info:
+        for key, value in header.items():
+            print("%s: %s" % (key, fat_time(value) if key == "start_time" else value))
+        if stats:
+            print_stats(stats, sys.stdout)
+        else:
+            print("no trailer (session not stopped cleanly)")
+        return
+
+    windows = decode_windows(data, header, end)
+    out = open(args.output, "w") if args.output else sys.stdout
+
+    # time_s is the time of the first sample of each window (RMS) or of each sample (raw), counted from the
+    # first sample in the file. Version 3+ uses the logged timestamps, so dropped windows appear as gaps;
+    # older versions assume the windows are back to back.
+    sample_s = 1.0 / header["sample_rate_hz"]
+    window_s = header["window_size"] * sample_s
+    first = None
+    starts = []
+    for i, (timestamp, _, _) in enumerate(windows):
+        if timestamp is None:
+            start = i * window_s
+        else:
+            start = timestamp / 1000.0 - (header["window_size"] - 1) * sample_s
+        if first is None:
+            first = start
+        starts.append(start - first)
+
+    if header["record_type"] == RECORD_RMS:
+        out.write("window,time_s,rms_mv,threshold_mv\n")
+        for i, (start, (_, values, threshold)) in enumerate(zip(starts, windows)):
+            # Undo the display scale so values are real mV at the ADC input
+            out.write("%d,%.4f,%.2f,%.2f\n" % (i, start, values[0] / header["rms_scale"],
+                                              threshold / header["rms_scale"]))
+    else:
+        out.write("sample,time_s,adc,mv,threshold_mv\n")
+        i = 0
+        for start, (_, values, threshold) in zip(starts, windows):
+            for j, adc in enumerate(values):
+                out.write("%d,%.6f,%d,%.1f,%.2f\n" % (i, start + j * sample_s, adc, adc * header["vref_mv"] / 1023.0,
+                                                      threshold / header["rms_scale"]))
+                i += 1
+
+    if out is not sys.stdout:
+        out.close()
+    if stats and stats["dropped_windows"]:
+        sys.stderr.write("warning: %d windows were dropped during recording\n" % stats["dropped_windows"])
+
+
+if __name__ == "__main__":
+    try:
+        main()
+    except ValueError as e:
+        sys.exit("error: %s" % e)
@@ -0,0 +1,64 @@
+/* Host test for Drivers/Logger/ReplayClock.c (replay timing and speed changes).
+ *
+ * Build and run on a PC from the repository root:
+ *     gcc -std=gnu99 -Wall -I Drivers/Logger Tools/replay_clock_test.c Drivers/Logger/ReplayClock.c -o replay_clock_test
+ *     ./replay_clock_test
+ *
+ * Exits with 0 when every check passes.
+ */
+
+#include <stdio.h>
+#include "ReplayClock.h"
+
+#define WINDOW_MS 50		// 480 samples at 9615 Hz
+#define AT_SPEED(ms, speed) (((ms) + (speed) - 1) / (speed))	// Real time of 'ms' log time (whole ms, rounded up)
+
+static int failures = 0;
+
+static void check(const char* name, int ok) {
+	if (!ok) {
+		printf("FAIL %s\n", name);
+		failures++;
+	}
+}
+
+// Runs the clock from 'now' until the window at 't' is due. Returns the real time it took (ms), or -1 after 10 s.
+static long wait_due(const ReplayClock* clock, uint32_t t, uint32_t now) {
+	for (long waited = 0; waited <= 10000; waited++) {
+		if (ReplayClock_Due(clock, t, now + waited)) return waited;
+	}
+	return -1;
+}
+
+int main(void) {
+	ReplayClock clock;
+	
+	// Normal playback at 1x: a window is due WINDOW_MS after the previous one, not before
+	ReplayClock_Start(&clock, 1000, 5000);
+	check("first window due at once", ReplayClock_Due(&clock, 1000, 5000));
+	check("next window not early", !ReplayClock_Due(&clock, 1000 + WINDOW_MS, 5000 + WINDOW_MS - 1));
+	check("next window on time", ReplayClock_Due(&clock, 1000 + WINDOW_MS, 5000 + WINDOW_MS));
+	
+	// Speed change while the pending window is overdue (the touch held the loop for 300 ms): it plays at once
+	// and the following windows keep their spacing at the new speed
+	ReplayClock_Start(&clock, 1000, 5000);
+	uint32_t pending = 1000 + WINDOW_MS;
+	ReplayClock_SetSpeed(&clock, 4, 5300, pending);
+	check("overdue window due after speed change", wait_due(&clock, pending, 5300) == 0);
+	check("next window at 4x", wait_due(&clock, pending + WINDOW_MS, 5300) == AT_SPEED(WINDOW_MS, 4));
+	ReplayClock_SetSpeed(&clock, 16, 5800, pending + 2 * WINDOW_MS);
+	check("overdue window due after second speed change", wait_due(&clock, pending + 2 * WINDOW_MS, 5800) == 0);
+	check("next window at 16x", wait_due(&clock, pending + 3 * WINDOW_MS, 5800) == AT_SPEED(WINDOW_MS, 16));
+	
+	// Speed change before the pending window is due: it keeps its remaining time, scaled to the new speed
+	ReplayClock_Start(&clock, 1000, 5000);
+	ReplayClock_SetSpeed(&clock, 4, 5010, 1000 + WINDOW_MS);
+	check("early speed change", wait_due(&clock, 1000 + WINDOW_MS, 5010) == AT_SPEED(WINDOW_MS - 10, 4));
+	
+	// Timer_Millis() and log timestamps wrapping around 2^32
+	ReplayClock_Start(&clock, 0xFFFFFFF0UL, 0xFFFFFFE0UL);
+	check("wrapped log time", wait_due(&clock, (uint32_t)(0xFFFFFFF0UL + WINDOW_MS), 0xFFFFFFE0UL) == WINDOW_MS);
+	
+	printf("%s: %d failures\n", failures ? "FAILED" : "OK", failures);
+	return failures ? 1 : 0;
+}
@@ -6,6 +6,7 @@
 #include <math.h>			// For using sqrt()
 #include <stdint.h>			// For fixed-width int types (uint16_t etc.)
 #include <avr/interrupt.h>	// ISR() and sei()
+#include <avr/eeprom.h>		// Persisted log file counter
 #include <string.h>			// string manipulation
 
 #include "USART_Driver.h"	// USART_Driver for debugging
@@ -14,21 +15,73 @@
 #include "ff.h"				// FatFS library header (used to read/write to SD cards f_open(), f_write(), f_close())
 #include "diskio.h"			// disk I/O used by FatFS (connects FatFS engine to SD driver)
 #include "SD_Driver.h"		// SD card driver
+#include "SD_Bench.h"		// SD card throughput benchmark (only with SD_BENCHMARK defined)
+#include "Timer_Driver.h"	// 1 ms system tick (Timer3)
+#include "Logger.h"			// Binary EMG log files
+#include "EMG_Codec.h"		// Packed 10-bit sample buffers
+#include "Replay.h"			// Reads log files back for replay
+#include "ReplayClock.h"		// Replay timing at 1x / 4x / 16x
 
 FATFS fs;
-FIL file;
-UINT bw;
+uint8_t fs_mounted = 0;		// 1 = volume is mounted and kept between logging sessions
+
+// SD card failures (shown on Screen A, the EMG control keeps running)
+#define SD_FAIL_MOUNT    1		// No card, or the card does not answer
+#define SD_FAIL_FULL     2		// All names EMG000-EMG999 are used
+#define SD_FAIL_OPEN     3		// Log file could not be created (or no log file to replay)
+#define SD_FAIL_WRITE    4		// Write error while logging and no new file could be opened (recording was stopped)
+#define SD_RETRY_MIN_MS  500	// Mount retry backoff: 0.5 s, doubled after every failed attempt ...
+#define SD_RETRY_MAX_MS  8000	// ... up to 8 s
+#define SD_MAX_REOPENS   3		// New log files opened after write errors before a recording is given up
+
+// Rolling log files: a recording continues in a new file (EMGnnn.BIN) when the current one reaches
+// LOGGER_SEGMENT_BYTES or LOG_SEGMENT_MS. The next file is created LOG_PREPARE_xxx before that.
+#define LOG_SEGMENT_MS       (10UL * 60UL * 1000UL)		// 10 minutes per file
+#define LOG_PREPARE_MS       (30UL * 1000UL)
+#define LOG_PREPARE_BYTES    (256UL * 1024UL)
+#define LOG_PREPARE_TRIES    3			// Failed attempts to create the next file before SD_FAIL_WRITE is shown ...
+#define LOG_PREPARE_RETRY_MS 5000		// ... one every 5 s
+#define LOG_WINDOW_MAX_BYTES (4 + RICE_BLOCK_MAX_BYTES(BUFFER_SIZE))	// Largest record of one window (timestamp + block)
+
+uint8_t  sd_error      = 0;		// Last SD failure (SD_FAIL_xxx), 0 = OK
+uint16_t sd_retry_ms   = SD_RETRY_MIN_MS;
+uint32_t sd_retry_from = 0;		// Timer_Millis() of the last failed attempt
+FRESULT  log_res       = FR_OK;	// First write error of the open log file
+uint32_t session_dropped_start;	// Dropped windows counter when the log file was opened
+uint8_t  session_reopens = 0;	// New log files opened after write errors in this recording
+uint8_t  session_open    = 0;	// 1 = a log file is open (between begin_session and end_session)
+uint32_t segment_start_ms;		// Timer_Millis() when the current log file was opened
+char     next_fname[16];		// Name and index of the file prepared for the next segment (valid when Logger_NextPrepared())
+uint16_t next_index;
+uint8_t  prepare_tries;			// Failed attempts to prepare the next file in this segment
+uint32_t prepare_from;			// Timer_Millis() of the last failed attempt
 
 #define BAUD         9600				// Baud rate for UART
 #define MYUBRR       (F_CPU/16/BAUD - 1)// Calculates baud rate for UART for baud rate register 
 
 #define VREF         5000				// ADC reference voltage
 #define BUFFER_SIZE  480				// EMG sample buffer size per processing window
+#define SAMPLE_RATE  9615				// ADC sample rate in Hz (125 kHz / 13 cycles per conversion)
+#define RMS_SCALE    4					// RMS values are scaled by 4 (gives better view on TFT)
+
+#define RAW_RICE_CODING 1				// Raw recording: 1 = delta/Rice coded windows (lossless), 0 = packed 10-bit windows
+
+#if BUFFER_SIZE % PACK10_GROUP_SAMPLES
+#error "BUFFER_SIZE must be a multiple of 4 (packed 10-bit sample groups)"
+#endif
 
 // EMG buffer and flags
-volatile uint16_t emg_samples[BUFFER_SIZE];	// EMG sample buffer of size BUFFER_SIZE = 480 (volatile because ISR updates this buffer)
-volatile uint16_t emg_index       = 0;		// For knowing index in emg_samples[] array
+// Two sample buffers: the ISR fills one while the main loop processes / logs the other
+// Samples are packed 4 per 5 bytes (EMG_Codec.h): 2 x 600 bytes instead of 2 x 960 bytes
+volatile uint8_t  emg_samples[2][PACK10_BYTES(BUFFER_SIZE)];	// Packed EMG sample buffers of BUFFER_SIZE = 480 samples (volatile because ISR updates them)
+volatile uint16_t emg_index       = 0;		// For knowing sample index in the buffer being filled
+volatile uint16_t emg_pack_pos    = 0;		// Byte offset of the current 5-byte group in the buffer being filled
+volatile uint8_t  emg_lane        = 0;		// Sample position (0-3) within the current group
+volatile uint8_t  emg_fill_buf    = 0;		// Buffer the ISR is filling (0 or 1)
+volatile uint8_t  emg_ready_buf   = 1;		// Buffer that is full and ready for processing (valid when emg_buffer_full is set)
 volatile uint8_t  emg_buffer_full = 0;		// Flag for when buffer is full and ready for processing / saving to SD etc.
+volatile uint32_t emg_window_ms[2];			// Timer_Millis() at the last sample of each buffer (set when it is handed over)
+volatile uint32_t emg_windows_dropped = 0;	// Windows overwritten because the main loop had not processed the previous one
 volatile uint8_t blink_flag = 0;			// Blink flag (set in Timer1 interrupt)
 extern volatile uint8_t touch_triggered;	// Touch flag for when touch triggered (defined in XPT2046_driver.c --> therefore extern volatile)
 
@@ -37,19 +90,63 @@ uint16_t x            = 319;	// The leftmost position on the horizontal position
 uint16_t rms_adc      = 0;		// holds RMS value of EMG from ADC
 uint32_t rms_mv       = 0;		// Holds RMS value in mV
 uint16_t threshold    = 100;	// EMG signal activation threshold for motor control
+uint16_t trace_scale_mv = 2000;	// RMS value (mV) drawn at the top of the Screen A trace
 uint16_t overThreshold  = 0;	// Counter for consecutive 'windows' where the EMG signals are over threshold
 uint16_t underThreshold = 0;	// Counter for consecutive 'windows' where the EMG signals are under threshold
+uint8_t  rice_block[RICE_BLOCK_MAX_BYTES(BUFFER_SIZE)];	// Window waiting to be logged (coded or packed), or being replayed
+uint16_t log_bytes;				// Bytes of the window in rice_block
+uint32_t log_rms_mv;			// RMS of the window waiting to be logged
+uint32_t log_t_ms;				// Its timestamp
+uint8_t  log_queued = 0;		// 1 = ScreenA() has queued a window for RecordService() to write
+// Next log file index, persisted across power cycles (check word holds the complement of the index)
+#define LOG_FILE_MAX 1000
+uint16_t EEMEM ee_next_log_index = 0xFFFF;
+uint16_t EEMEM ee_next_log_check = 0xFFFF;
+
+uint8_t  record_raw     = 0;	// Logging mode: 0 = one RMS value per window, 1 = every raw ADC sample
+uint8_t  recording      = 0;	// 1 = a recording is running alongside the live view (log button)
+uint8_t  rec_blink      = 0;	// Recording indicator on the log button is lit (toggled once per second)
+
+// Replay: the last log file is fed through the RMS/threshold/display path instead of the ADC.
+// The replay button cycles off -> 1x (real time) -> 4x -> 16x -> off.
+#define REPLAY_SPEED_MAX 16
+uint8_t  replay_speed   = 0;	// 0 = live ADC input, otherwise replay speed factor
+uint8_t  replay_rms     = 0;	// 1 = replayed file holds RMS values (replay_rms_mv), 0 = raw samples (in the sample buffer)
+uint8_t  replay_pending = 0;	// 1 = next window has been read and waits for its time
+uint16_t replay_rms_mv;			// RMS value of the pending window (RMS logs)
+uint32_t replay_t_ms;			// Timestamp of the pending window
+uint16_t replay_threshold;		// Threshold the pending window was decided with (header, then threshold records)
+ReplayClock replay_clock;		// Log time of the replay (speed = replay_speed)
+uint16_t live_threshold;		// Threshold before the replay (restored afterwards)
 char buffer[12];				// Used for converting numerical values into string for UART
 
+#define THRESHOLD_STEP  10				// Threshold change (mV) per tap on the +/- buttons
+#define THRESHOLD_MIN   10				// Lowest threshold the buttons can set
+#define THRESHOLD_MAX   5000			// Highest threshold the buttons can set
+#define TRACE_SCALE_MIN 500				// Smallest full-scale value (mV) for the trace
+#define TRACE_SCALE_MAX 4000			// Largest full-scale value (mV) for the trace
+
 
-// Screen states
+// Button glyphs drawn on top of the button colour
 typedef enum {
-	STATE_SCREEN_A,	// Live EMG visualization and motor control screen
-	STATE_SCREEN_B	// EMG data logging screen
-} ScreenState;
+	GLYPH_NONE,
+	GLYPH_PLUS,
+	GLYPH_MINUS,
+	GLYPH_MODE,		// Filled square when raw recording is selected
+	GLYPH_RECORD,	// Blinking red square while a recording is running
+	GLYPH_REPLAY	// One white mark per speed step while replaying
+} ButtonGlyph;
 
-// Tracks current screen state
-ScreenState current_state = STATE_SCREEN_A;
+// Touch button: a rectangle in touch coordinates (x = 0..319 left to right, y = 0..239 top to bottom)
+typedef struct {
+	uint16_t x, y;				// Upper left corner
+	uint16_t w, h;				// Width and height
+	uint8_t  red, green, blue;	// Button colour (RGB565 components)
+	ButtonGlyph glyph;			// Symbol drawn on the button
+	void (*on_press)(void);		// Called when the button is touched
+} TouchButton;
+
+#define BUTTON_COUNT(table) (sizeof(table) / sizeof((table)[0]))
 
 
 
@@ -78,8 +175,10 @@ void pwm_set_duty(uint16_t duty_percent) {
 // Initializes the ADC to read from channel ADC4 with AVcc as the reference
 void adc_init(void) {
 	ADMUX = (1 << REFS0) | (1 << MUX2);				// AVcc as reference, ADC4 as input channel
+	ADCSRB = 0;										// Auto trigger source: free running
 	ADCSRA = (1 << ADEN)							// Enable ADC
 	| (1 << ADIE)									// Enable ADC interrupt
+	| (1 << ADATE)									// Free running: next conversion starts in hardware, so interrupt latency (SD/SPI interrupts) gives no sample jitter
 	| (1 << ADPS2) | (1 << ADPS1) | (1 << ADPS0);	// Prescaler=128 => f_ADC = 125kHz            ** 125kHz / 13 = 9.6kHz sampling **
 	sei();											// Enable global interrupts
 	ADCSRA |= (1 << ADSC);							// Start first conversion
@@ -87,12 +186,56 @@ void adc_init(void) {
 
 // ISR triggers when ADC conversion complete
 ISR(ADC_vect) {
-	emg_samples[emg_index++] = ADC;	// Store ADC result in EMG sample buffer, increment index
-	if (emg_index >= BUFFER_SIZE) {	// If buffer is full:
+	uint16_t sample = ADC;
+	volatile uint8_t *group = &emg_samples[emg_fill_buf][emg_pack_pos];
+	
+	// Store ADC result packed (low 8 bits in the sample's own byte, high 2 bits in byte 4 of the group)
+	group[emg_lane] = (uint8_t)sample;
+	if (emg_lane == 0) {
+		group[4] = sample >> 8;							// First sample of group also clears the other high bits
+	} else {
+		group[4] |= (uint8_t)(sample >> 8) << (2 * emg_lane);
+	}
+	if (++emg_lane == PACK10_GROUP_SAMPLES) {
+		emg_lane = 0;
+		emg_pack_pos += PACK10_GROUP_BYTES;
+	}
+	
+	if (++emg_index >= BUFFER_SIZE) {	// If buffer is full:
 		emg_index = 0;					// Reset index
-		emg_buffer_full = 1;			// Set flag that buffer is full
+		emg_pack_pos = 0;
+		if (emg_buffer_full) {
+			emg_windows_dropped++;		// Previous window not processed yet --> refill this buffer (window is lost)
+		} else {
+			emg_window_ms[emg_fill_buf] = Timer_MillisFromISR();	// Timestamp of the window (its last sample)
+			emg_ready_buf = emg_fill_buf;	// Hand the full buffer to the main loop
+			emg_fill_buf ^= 1;				// and continue in the other one
+			emg_buffer_full = 1;			// Set flag that buffer is full
+		}
 	}
-	ADCSRA |= (1 << ADSC);			// start next conversion
+}
+
+// Reads the dropped window counter (32-bit read must not be split by the ADC interrupt)
+static uint32_t get_windows_dropped(void) {
+	uint8_t sreg = SREG;
+	cli();
+	uint32_t dropped = emg_windows_dropped;
+	SREG = sreg;
+	return dropped;
+}
+
+// Stops handing ADC windows to the main loop (replay fills the buffers instead). The ADC keeps converting.
+static void adc_pause(void) {
+	ADCSRA &= ~(1 << ADIE);
+}
+
+// Hands ADC windows to the main loop again, starting with a fresh window
+static void adc_resume(void) {
+	emg_index       = 0;
+	emg_pack_pos    = 0;
+	emg_lane        = 0;
+	emg_buffer_full = 0;
+	ADCSRA |= (1 << ADIF) | (1 << ADIE);	// Writing 1 clears a conversion that completed meanwhile
 }
 /*************************************************************************************************************************/
 
@@ -114,14 +257,17 @@ ISR(TIMER1_COMPA_vect) {
 
 
 /************************************************ RMS Calculation ********************************************************/
-// Calculates the RMS value of samples i buffer
+// Calculates the RMS value of samples in the ready buffer
 uint16_t calculate_RMS(void) {
+	const uint8_t *packed = (const uint8_t *)emg_samples[emg_ready_buf];	// Not written by the ISR while emg_buffer_full is set
+	uint16_t samples[PACK10_GROUP_SAMPLES];
 	
 	// 1. Compute mean of all samples
 	uint32_t sum = 0;
 											
-	for (uint16_t i = 0; i < BUFFER_SIZE; i++) {
-		sum += emg_samples[i];			// Sum all samples
+	for (uint16_t g = 0; g < PACK10_BYTES(BUFFER_SIZE); g += PACK10_GROUP_BYTES) {
+		Pack10_Unpack4(&packed[g], samples);
+		sum += samples[0] + samples[1] + samples[2] + samples[3];	// Sum all samples
 	}
 	uint16_t mean = sum / BUFFER_SIZE;	// Calculate the mean
 
@@ -129,9 +275,12 @@ uint16_t calculate_RMS(void) {
 	// 2. Calculate sum of squared deviations from mean    \sum{x_i - \mu}^2
 	uint32_t sum_squares = 0;
 	
-	for (uint16_t i = 0; i < BUFFER_SIZE; i++) {
-		int16_t centered = (int16_t)emg_samples[i] - (int16_t)mean;	// Center sample around mean because of DC bias --> Cast to int16_t for negative values (some might be below the mean => negative numbers!)
-		sum_squares += (uint32_t)centered * centered;				// Add square of sampled value
+	for (uint16_t g = 0; g < PACK10_BYTES(BUFFER_SIZE); g += PACK10_GROUP_BYTES) {
+		Pack10_Unpack4(&packed[g], samples);
+		for (uint8_t i = 0; i < PACK10_GROUP_SAMPLES; i++) {
+			int16_t centered = (int16_t)samples[i] - (int16_t)mean;	// Center sample around mean because of DC bias --> Cast to int16_t for negative values (some might be below the mean => negative numbers!)
+			sum_squares += (uint32_t)((int32_t)centered * centered);	// Add square of sampled value
+		}
 	}
 	
 	// 3. Calculate mean of squared differences    1/N * \sum{x_i - \mu}^2
@@ -144,63 +293,767 @@ uint16_t calculate_RMS(void) {
 
 
 /************************************************ Motor Control **********************************************************/
+// The servo is driven for a fixed time per move and then released (duty 0).
+// The move runs while the main loop continues; the Timer4 overflow interrupt (once per 20 ms PWM period) ends it,
+// so the drive time does not depend on the main loop (HandleTouch blocks it until the finger is lifted).
+#define SERVO_CLOSE_MS 500
+#define SERVO_OPEN_MS  475
+
+static volatile uint16_t servo_ms;	// PWM stays on until servo_ms has passed since servo_from
+static volatile uint32_t servo_from;
+
+static void servo_move(uint16_t duty, uint16_t ms) {
+	uint8_t sreg = SREG;
+	cli();						// OCR4C and the move time are also written by the interrupt
+	pwm_set_duty(duty);
+	servo_ms   = ms;
+	servo_from = Timer_MillisFromISR();
+	TIFR4  = (1 << TOV4);		// Count from the next period
+	TIMSK4 |= (1 << TOIE4);
+	SREG = sreg;
+}
+
 // 'Closes' the servo motor
 void closeHand(void) {
-	pwm_set_duty(6);	
-	_delay_ms(500);
-	pwm_set_duty(0);
+	servo_move(6, SERVO_CLOSE_MS);
 }
 
 // 'Opens' the servo motor
 void openHand(void) {
-	pwm_set_duty(9);
-	_delay_ms(475);
-	pwm_set_duty(0);
+	servo_move(9, SERVO_OPEN_MS);
+}
+
+// Releases the servo at the end of the first PWM period after the move has had its time
+ISR(TIMER4_OVF_vect) {
+	if (Timer_MillisFromISR() - servo_from >= servo_ms) {
+		OCR4C = 0;
+		TIMSK4 &= ~(1 << TOIE4);
+	}
 }
 /*************************************************************************************************************************/
 
 
 /************************************************ Helpers for SD *******************************************************/
-// Generates the correct filename for the EMG data
-// Scans for available filenames in the format "EMG000.TXT" to "EMG999.TXT"
-// Returns the first unused filename in 'filename_out'
-// If all names are taken, defaults to "EMG999.TXT"
-static void get_new_filename(char *filename_out) {
+// Log files are named "EMG000.BIN" to "EMG999.BIN". get_new_filename() takes the next index from EEPROM
+// (checked with its complement and one f_stat); scan_next_index() reads the directory only when that index
+// is invalid or already used.
+
+// Makes sure the SD card volume is mounted.
+// The volume stays mounted between sessions, so normally only a quick card check (CMD13) is needed
+// instead of a full f_mount (SD_init at the slow SPI clock + reading the boot sector and FSInfo).
+// If the card was removed or swapped, the volume is mounted again. Returns FR_OK when the volume is ready.
+static FRESULT mount_sd(void) {
+	if (fs_mounted && SD_check() == 0) {
+		return FR_OK;
+	}
+	Logger_FinishPrevious();	// Previous segment still open: finish it on the old mount (best effort)
+	fs_mounted = 0;
+	FRESULT res = f_mount(&fs, "", 1);
+	if (res == FR_OK) {
+		fs_mounted = 1;
+	}
+	return res;
+}
+
+// Scans the root directory once and returns the index after the highest existing EMGnnn.BIN (0 if none)
+static uint16_t scan_next_index(void) {
+	DIR dir;
+	FILINFO fno;
+	uint16_t next = 0;
+	
+	FRESULT res = f_findfirst(&dir, &fno, "", "EMG???.BIN");
+	while (res == FR_OK && fno.fname[0]) {
+		const char *digits = &fno.fname[3];
+		if (digits[0] >= '0' && digits[0] <= '9' && digits[1] >= '0' && digits[1] <= '9' && digits[2] >= '0' && digits[2] <= '9') {
+			uint16_t idx = (digits[0] - '0') * 100 + (digits[1] - '0') * 10 + (digits[2] - '0');
+			if (idx >= next) {
+				next = idx + 1;
+			}
+		}
+		res = f_findnext(&dir, &fno);
+	}
+	f_closedir(&dir);
+	return next;
+}
+
+// Finds the next free log file name "EMGnnn.BIN".
+// The next index is kept in EEPROM, so normally only one f_stat is needed no matter how many files are on the card.
+// If the stored index is invalid or already taken (e.g. another card), the directory is scanned once.
+// Returns 0 when all 1000 names are used.
+static uint8_t get_new_filename(char *filename_out, uint16_t *index_out) {
 	FILINFO fno;	// File info struct used by FatFs to hold file metadata --> Used by f_stat
+	uint16_t idx = eeprom_read_word(&ee_next_log_index);
+	
+	if (idx != (uint16_t)~eeprom_read_word(&ee_next_log_check) || idx >= LOG_FILE_MAX) {
+		idx = scan_next_index();							// Store empty or corrupt
+	} else {
+		sprintf(filename_out, "EMG%03u.BIN", idx);
+		if (f_stat(filename_out, &fno) != FR_NO_FILE) {
+			idx = scan_next_index();						// Name already used: stored index belongs to another card
+		}
+	}
+	if (idx >= LOG_FILE_MAX) {
+		return 0;											// EMG999.BIN exists: card is full of log files
+	}
+	
+	sprintf(filename_out, "EMG%03u.BIN", idx);				// Format index into a filename: "EMG000.BIN", "EMG001.BIN", ..., "EMG999.BIN"
+	*index_out = idx;
+	return 1;
+}
+
+// Finds the newest log file (the one before the next free index). Returns 0 if there is none.
+static uint8_t get_last_filename(char *filename_out) {
+	FILINFO fno;
+	uint16_t idx = eeprom_read_word(&ee_next_log_index);
+	
+	if (idx != (uint16_t)~eeprom_read_word(&ee_next_log_check) || idx == 0 || idx > LOG_FILE_MAX) {
+		idx = scan_next_index();
+	} else {
+		sprintf(filename_out, "EMG%03u.BIN", idx - 1);
+		if (f_stat(filename_out, &fno) != FR_OK) {
+			idx = scan_next_index();						// Stored index belongs to another card
+		}
+	}
+	if (idx == 0) {
+		return 0;
+	}
+	sprintf(filename_out, "EMG%03u.BIN", idx - 1);
+	return 1;
+}
+
+// Stores the index after 'index' as the next log file index
+static void save_next_index(uint16_t index) {
+	eeprom_update_word(&ee_next_log_index, index + 1);
+	eeprom_update_word(&ee_next_log_check, (uint16_t)~(index + 1));
+}
+
+
+// Creates the log file and writes the header with the current acquisition parameters and logging mode
+static FRESULT start_log(const char *fname) {
+	LoggerConfig config = {
+		.sample_rate_hz = SAMPLE_RATE,
+		.window_size    = BUFFER_SIZE,
+		.vref_mv        = VREF,
+		.threshold_mv   = threshold,
+		.rms_scale      = RMS_SCALE
+	};
+#if RAW_RICE_CODING
+	return Logger_Start(fname, record_raw ? EMG_LOG_RECORD_RICE : EMG_LOG_RECORD_RMS, &config);
+#else
+	return Logger_Start(fname, record_raw ? EMG_LOG_RECORD_RAW10 : EMG_LOG_RECORD_RMS, &config);
+#endif
+}
+
+
+// Logs a single RMS value (in millivolts) to the open SD file as a binary record.
+// Must only be called after start_log() has succeeded.
+static FRESULT log_rms_to_sd(uint32_t t_ms, uint32_t rms_mv) {
+	return Logger_WriteRms(t_ms, rms_mv > 0xFFFF ? 0xFFFF : (uint16_t)rms_mv);	// Max value is VREF * RMS_SCALE = 20000 mV, so this never clips
+}
+
+// Logs a threshold change, so a replay of the file uses the new threshold from the next window on
+static void log_threshold(void) {
+	if (!session_open) return;
+	FRESULT res = Logger_WriteThreshold(threshold);
+	if (res != FR_OK && log_res == FR_OK) {
+		log_res = res;								// Handled in RecordService (new log file)
+	}
+}
+
+// Remembers an SD failure and restarts the mount retry backoff
+static void set_sd_error(uint8_t error) {
+	sd_error      = error;
+	sd_retry_ms   = SD_RETRY_MIN_MS;
+	sd_retry_from = Timer_Millis();
+}
+
+// Mounts the card (if needed) and opens a new log file (the prepared one, if there is one).
+// Every file starts with fresh smoothing counters, as in a replay of the file, so the replay takes the same
+// decisions: also the next file after a write error or at a segment switch.
+// Returns 1 on success, otherwise sets sd_error and returns 0.
+static uint8_t begin_session(void) {
+	char fname[16];
+	uint16_t log_index;
+	uint8_t error = 0;
+	
+	if (mount_sd() != FR_OK) {
+		error = SD_FAIL_MOUNT;
+	} else if (Logger_NextPrepared()) {
+		strcpy(fname, next_fname);
+		log_index = next_index;
+	} else if (!get_new_filename(fname, &log_index)) {
+		error = SD_FAIL_FULL;
+	}
+	if (!error && start_log(fname) != FR_OK) {
+		error = SD_FAIL_OPEN;
+	}
+	if (error) {
+		set_sd_error(error);
+		return 0;
+	}
+	
+	save_next_index(log_index);
+	segment_start_ms = Timer_Millis();
+	prepare_tries = 0;
+	overThreshold  = 0;
+	underThreshold = 0;
+	session_dropped_start = get_windows_dropped();
+	session_open = 1;
+	log_res  = FR_OK;
+	sd_error = 0;
+	return 1;
+}
+
+// Closes the log file (writes the session statistics).
+// 'next_segment' = 1: a new segment follows at once, the old file is truncated later (Logger_StopSegment).
+static void end_session(uint8_t next_segment) {
+	if (!session_open) return;
+	session_open = 0;
+	if (next_segment) {
+		Logger_StopSegment(get_windows_dropped() - session_dropped_start);
+	} else {
+		Logger_Stop(get_windows_dropped() - session_dropped_start);
+	}
+}
+
+// Write error while logging: closes the broken file and continues in a new one.
+// If the card is gone the volume is mounted again first. Returns 1 if logging can continue.
+static uint8_t rotate_session(void) {
+	end_session(0);
+	if (++session_reopens > SD_MAX_REOPENS) {
+		set_sd_error(SD_FAIL_WRITE);
+		return 0;
+	}
+	if (begin_session()) return 1;
+	if (sd_error == SD_FAIL_MOUNT) sd_error = SD_FAIL_WRITE;	// Show that a recording was cut short
+	return 0;
+}
+
+// Rolling log files: creates the next file shortly before the current one reaches its size or duration cap,
+// and switches to it at the cap. Called between windows, so the ADC double buffer covers the file operations.
+// Returns 0 if the recording could not continue in a new file.
+static uint8_t SegmentService(void) {
+	uint32_t age  = Timer_Millis() - segment_start_ms;
+	uint32_t room = Logger_BytesFree();
+	
+	if (age >= LOG_SEGMENT_MS || room < LOG_WINDOW_MAX_BYTES) {
+		end_session(1);
+		if (begin_session()) return 1;
+		Logger_FinishPrevious();	// No new segment (no card, card full, ...): finish the old one now
+		if (sd_error == SD_FAIL_MOUNT) sd_error = SD_FAIL_WRITE;	// Show that a recording was cut short
+		return 0;
+	}
+	
+	// On failure the switch creates the file itself; the attempts are limited so a bad card does not
+	// cost a file operation on every pass
+	if (!Logger_NextPrepared() && !emg_buffer_full && (age >= LOG_SEGMENT_MS - LOG_PREPARE_MS || room < LOG_PREPARE_BYTES)
+	    && prepare_tries < LOG_PREPARE_TRIES && (prepare_tries == 0 || Timer_Millis() - prepare_from >= LOG_PREPARE_RETRY_MS)) {
+		if (!get_new_filename(next_fname, &next_index) || Logger_PrepareNext(next_fname) != FR_OK) {
+			prepare_from = Timer_Millis();
+			if (++prepare_tries == LOG_PREPARE_TRIES) {
+				sd_error = SD_FAIL_WRITE;	// Shown while the recording continues; cleared again if the switch succeeds
+			}
+		}
+	}
+	return 1;
+}
+
+// Starts a recording in a new log file. Returns 0 (and sets sd_error) if no file could be opened.
+static uint8_t StartRecording(void) {
+	session_reopens = 0;
+	if (!begin_session()) return 0;
+	log_queued = 0;
+	recording = 1;
+	rec_blink = 1;
+	blink_flag = 0;
+	return 1;
+}
+
+// Ends the recording: closes the log file (writes the session statistics)
+static void StopRecording(void) {
+	end_session(0);
+	Logger_FinishPrevious();	// Segment switch failed: the previous file may still be open
+	Logger_CancelNext();	// Recording ended before the prepared file was needed
+	recording = 0;
+	
+	//*** Send session statistics over UART (FOR DEBUGGING) ***//
+	//LoggerStats stats;
+	//Logger_GetStats(&stats);
+	//ultoa(stats.samples, buffer, 10);
+	//USART0_SendString(buffer);
+	//USART0_Transmit(' ');
+	//ultoa(stats.dropped_windows, buffer, 10);
+	//USART0_SendString(buffer);
+	//USART0_Transmit(' ');
+	//ultoa(stats.bytes * 1000UL / stats.duration_ms, buffer, 10);	// Sustained throughput (bytes/s)
+	//USART0_SendString(buffer);
+	//USART0_Transmit('\n');
+	/***********************************************************/
+}
+/*************************************************************************************************************************/
+
+
+/************************************************ Replay ****************************************************************/
+// Opens the newest log file and switches the processing input from the ADC to it, with the threshold of the
+// recording and fresh smoothing counters, so the hand takes the same decisions as when it was recorded.
+// Returns 0 (and sets sd_error) if there is no card or no log file that can be replayed.
+static uint8_t StartReplay(void) {
+	char fname[16];
+	EmgLogHeader header;
+	
+	if (mount_sd() != FR_OK) {
+		set_sd_error(SD_FAIL_MOUNT);
+		return 0;
+	}
+	if (!get_last_filename(fname) || Replay_Open(fname, &header) != FR_OK) {
+		set_sd_error(SD_FAIL_OPEN);
+		return 0;
+	}
+	
+	adc_pause();
+	emg_buffer_full = 0;
+	replay_threshold = header.config.threshold_mv;
+	
+	// Raw windows are decoded into the sample buffer, so they must have the same size
+	if ((header.record_type != EMG_LOG_RECORD_RMS && header.config.window_size != BUFFER_SIZE)
+	    || !Replay_Next(&replay_t_ms, &replay_rms_mv, &replay_threshold, (uint8_t *)emg_samples[emg_ready_buf], rice_block)) {
+		Replay_Close();
+		adc_resume();
+		set_sd_error(SD_FAIL_OPEN);
+		return 0;
+	}
+	replay_rms     = (header.record_type == EMG_LOG_RECORD_RMS);
+	replay_pending = 1;
+	replay_speed   = 1;
+	ReplayClock_Start(&replay_clock, replay_t_ms, Timer_Millis());
+	
+	live_threshold = threshold;
+	threshold      = replay_threshold;
+	overThreshold  = 0;
+	underThreshold = 0;
+	if (sd_error != SD_FAIL_WRITE) sd_error = 0;	// A cut-short recording stays shown until the next recording
+	return 1;
+}
+
+// Ends the replay and returns to the live ADC input
+static void StopReplay(void) {
+	Replay_Close();
+	replay_speed = 0;
+	threshold = live_threshold;
+	adc_resume();
+}
+
+// Next replay speed (x4), or off after REPLAY_SPEED_MAX. The replay continues from the current log time.
+static void NextReplaySpeed(void) {
+	if (replay_speed >= REPLAY_SPEED_MAX) {
+		StopReplay();
+		return;
+	}
+	replay_speed *= 4;
+	// The pending window is usually overdue by now (the touch is handled after the finger is lifted)
+	ReplayClock_SetSpeed(&replay_clock, replay_speed, Timer_Millis(), replay_t_ms);
+}
+/*************************************************************************************************************************/
+
+
+/************************************************ Touch buttons *********************************************************/
+// Maps an RMS value (mV) to a trace height (0-239) using the current trace scale
+static uint8_t map_to_trace(uint32_t mv) {
+	uint32_t sample = (mv * 239UL) / trace_scale_mv;
+	return (sample > 239) ? 239 : (uint8_t)sample;
+}
+
+// Redraws Screen A: axes, threshold line and buttons
+static void DrawScreenA(void);
+
+// Display column of the threshold line
+static uint16_t threshold_column(void);
+
+// Moves the threshold line from 'old_column' to the current threshold (without redrawing the screen)
+static void MoveThresholdLine(uint16_t old_column);
+
+// Redraws the log button (recording indicator)
+static void DrawLogButton(void);
+
+// Start/stop recording. The live view and motor control keep running either way.
+static void OnLogButton(void) {
+	if (replay_speed) return;		// Only live input is recorded
+	if (recording) {
+		StopRecording();
+		DrawLogButton();
+	} else if (StartRecording()) {
+		DrawScreenA();		// Also clears an old SD error
+	} else {
+		DrawScreenA();		// Shows the SD error
+	}
+}
+
+// Raises the activation threshold one step
+static void OnThresholdUp(void) {
+	uint16_t old_column = threshold_column();
+	if (threshold + THRESHOLD_STEP <= THRESHOLD_MAX) threshold += THRESHOLD_STEP;
+	log_threshold();
+	MoveThresholdLine(old_column);
+}
+
+// Lowers the activation threshold one step
+static void OnThresholdDown(void) {
+	uint16_t old_column = threshold_column();
+	if (threshold >= THRESHOLD_MIN + THRESHOLD_STEP) threshold -= THRESHOLD_STEP;
+	log_threshold();
+	MoveThresholdLine(old_column);
+}
+
+// Replay of the newest log file: off -> 1x -> 4x -> 16x -> off
+static void OnReplayButton(void) {
+	if (recording) return;			// The recording owns the card
+	if (replay_speed) {
+		NextReplaySpeed();
+	} else {
+		StartReplay();				// On failure DrawScreenA shows the SD error
+	}
+	DrawScreenA();					// Threshold line of the recording / live threshold again
+}
+
+// Toggles the logging mode between RMS values and raw samples (not while recording: the file has one record type)
+static void OnRecordMode(void) {
+	if (recording) return;
+	record_raw = !record_raw;
+	DrawScreenA();
+}
+
+// Cycles the trace full-scale value: 500 -> 1000 -> 2000 -> 4000 -> 500 mV
+// The trace drawn so far keeps its old scale until the cursor erases it.
+static void OnTraceScale(void) {
+	uint16_t old_column = threshold_column();
+	trace_scale_mv = (trace_scale_mv >= TRACE_SCALE_MAX) ? TRACE_SCALE_MIN : trace_scale_mv * 2;
+	MoveThresholdLine(old_column);
+}
+
+// Buttons shown in Screen A (row along the top edge)
+static const TouchButton screen_a_buttons[] = {
+	{  45, 0, 45, 40, 20, 40, 20, GLYPH_MODE,  OnRecordMode    },	// RMS / raw logging (grey, black square = raw)
+	{ 100, 0, 45, 40,  0, 31, 31, GLYPH_NONE,  OnTraceScale    },	// Trace scale (cyan)
+	{ 155, 0, 45, 40, 31, 40,  0, GLYPH_MINUS, OnThresholdDown },	// Threshold - (orange)
+	{ 210, 0, 45, 40, 31, 40,  0, GLYPH_PLUS,  OnThresholdUp   },	// Threshold + (orange)
+	{ 265, 0, 55, 40,  0, 50,  0, GLYPH_RECORD, OnLogButton    },	// Start/stop recording (green, blinking red square while recording)
+	{ 265, 200, 55, 40, 20, 0, 31, GLYPH_REPLAY, OnReplayButton },	// Replay last log file / speed (purple, bottom right)
+};
+
+// Draws a button. Touch x runs opposite the display page address, touch y follows the column address.
+static void DrawButton(const TouchButton *b) {
+	uint16_t column = b->y;
+	uint16_t page   = 319 - (b->x + b->w - 1);
+	
+	FillRectangle(column, page, b->h, b->w, b->red, b->green, b->blue);
+	
+	uint16_t mid_column = column + b->h / 2;
+	uint16_t mid_page   = page + b->w / 2;
+	
+	if (b->glyph == GLYPH_PLUS || b->glyph == GLYPH_MINUS) {
+		FillRectangle(mid_column - 1, mid_page - 10, 3, 21, 0, 0, 0);	// Horizontal bar
+	}
+	if (b->glyph == GLYPH_PLUS) {
+		FillRectangle(mid_column - 10, mid_page - 1, 21, 3, 0, 0, 0);	// Vertical bar
+	}
+	if (b->glyph == GLYPH_MODE && record_raw) {
+		FillRectangle(mid_column - 8, mid_page - 8, 17, 17, 0, 0, 0);	// Raw mode selected
+	}
+	if (b->glyph == GLYPH_RECORD && recording && rec_blink) {
+		FillRectangle(mid_column - 8, mid_page - 8, 17, 17, 31, 0, 0);	// Recording
+	}
+	if (b->glyph == GLYPH_REPLAY) {
+		uint8_t i = 0;
+		for (uint8_t speed = 1; speed <= replay_speed; speed *= 4) {
+			FillRectangle(mid_column - 3, mid_page - 15 + i * 12, 6, 6, 31, 63, 31);	// Speed step
+			i++;
+		}
+	}
+}
+
+// Draws all buttons in a table
+static void DrawButtons(const TouchButton *buttons, uint8_t count) {
+	for (uint8_t i = 0; i < count; i++) {
+		DrawButton(&buttons[i]);
+	}
+}
+
+static void DrawLogButton(void) {
+	for (uint8_t i = 0; i < BUTTON_COUNT(screen_a_buttons); i++) {
+		if (screen_a_buttons[i].glyph == GLYPH_RECORD) {
+			DrawButton(&screen_a_buttons[i]);
+		}
+	}
+}
+
+// Reads the touch position and calls the handler of the button that was hit.
+// Blocks until the finger is lifted (GetCoordinates waits for release and debounces).
+// Touches outside all buttons are ignored.
+static void HandleTouch(const TouchButton *buttons, uint8_t count) {
+	uint16_t tx = 0xFFFF, ty = 0xFFFF;	// Stays outside all buttons if the touch was released too quickly
+	GetCoordinates(&tx, &ty);
 	
-	for (uint16_t idx = 0; idx < 1000; idx++) {
-		sprintf(filename_out, "EMG%03u.TXT", idx);			// Format index into a filename: "EMG000.TXT", "EMG001.TXT", ..., "EMG999.TXT"
-		if (f_stat(filename_out, &fno) == FR_NO_FILE) {		// Check if file does NOT exist on SD card and then returns TRUE
-			return;											// If file does not exist, stop loop and now filename_out contains the next file name
+	for (uint8_t i = 0; i < count; i++) {
+		const TouchButton *b = &buttons[i];
+		if (tx >= b->x && tx < b->x + b->w && ty >= b->y && ty < b->y + b->h) {
+			b->on_press();
+			return;
 		}
 	}
+}
+
+// Draws the SD status field left of the buttons (touch x 0-39):
+// red with one white mark per SD_FAIL_xxx code when the last SD operation failed, white when OK
+static void DrawSdStatus(void) {
+	uint16_t page = 319 - 39;
+	
+	if (!sd_error) {
+		FillRectangle(0, page, 40, 40, 31, 63, 31);
+		return;
+	}
+	FillRectangle(0, page, 40, 40, 31, 0, 0);
+	for (uint8_t i = 0; i < sd_error; i++) {
+		FillRectangle(17, page + 4 + i * 9, 6, 6, 31, 63, 31);
+	}
+}
+
+// Display column of the threshold line (same height mapping as DrawEMG)
+static uint16_t threshold_column(void) {
+	return 239 - ((map_to_trace(threshold) * 240UL) / 256);
+}
+
+static void DrawScreenA(void) {
+	InitCoordinate();	// White background and axes
+	
+	// Threshold line across the trace
+	DrawVerticalLine(threshold_column(), 0, 319, 0, 0, 31);
+	
+	DrawButtons(screen_a_buttons, BUTTON_COUNT(screen_a_buttons));
+	DrawSdStatus();		// White when OK: the trace and the threshold line stay out of this square
+}
+
+// Free trace columns in pages 'first'-'last': the buttons (and the SD status) sit at the top and bottom edge
+// of the trace, so the free part is one range 'lo'-'hi'
+static void trace_columns(uint16_t first, uint16_t last, uint16_t *lo, uint16_t *hi) {
+	*lo = 0;
+	*hi = 239;
+	if (last >= 319 - 39) *lo = 40;				// SD status square
+	for (uint8_t i = 0; i < BUTTON_COUNT(screen_a_buttons); i++) {
+		const TouchButton *b = &screen_a_buttons[i];
+		uint16_t page = 319 - (b->x + b->w - 1);
+		if (last < page || first > page + b->w - 1) continue;
+		if (b->y == 0) {
+			if (*lo < b->h) *lo = b->h;
+		} else if (*hi > b->y - 1) {
+			*hi = b->y - 1;
+		}
+	}
+}
+
+// Erases the trace of the previous pass in the 3 pages at 'x' and redraws the axes and the threshold line there.
+// At most 3 x 240 pixels per window, where a full DrawScreenA() at the wrap took about 190 ms.
+static void EraseTrace(uint16_t x) {
+	uint16_t lo, hi;
+	uint16_t first = (x > 318) ? 318 : x;		// Pages DrawEMG draws at 'x'
+	uint16_t last  = (first + 2 > 319) ? 319 : first + 2;
+	uint16_t column = threshold_column();
+	
+	trace_columns(first, last, &lo, &hi);
+	FillRectangle(lo, first, hi - lo + 1, last - first + 1, 31, 63, 31);
+	if (first <= 260 && last >= 260) DrawHorizontalLine(260, lo, hi, 0, 0, 0);	// Axes as in InitCoordinate
+	DrawVerticalLine(120, first, last, 0, 0, 0);
+	if (column >= lo && column <= hi) DrawVerticalLine(column, first, last, 0, 0, 31);
+}
+
+// Draws 'column' over all pages where it is not covered by a button or the SD status square
+static void DrawTraceColumn(uint16_t column, uint8_t red, uint8_t green, uint8_t blue) {
+	uint16_t lo, hi, start = 0;
+	uint8_t in_run = 0;
+	
+	for (uint16_t page = 0; page <= 320; page++) {
+		uint8_t free = 0;
+		if (page < 320) {
+			trace_columns(page, page, &lo, &hi);
+			free = (column >= lo && column <= hi);
+		}
+		if (free && !in_run) {
+			start  = page;
+			in_run = 1;
+		} else if (!free && in_run) {
+			DrawVerticalLine(column, start, page - 1, red, green, blue);
+			in_run = 0;
+		}
+	}
+}
+
+// A full DrawScreenA() takes about 190 ms and would cost several windows per tap while recording.
+// The old line is erased outside the buttons (axes restored) and the new one drawn; trace points on the
+// old line are redrawn by the next pass.
+static void MoveThresholdLine(uint16_t old_column) {
+	uint16_t column = threshold_column();
+	uint16_t lo, hi;
+	
+	if (column == old_column) return;
+	DrawTraceColumn(old_column, 31, 63, 31);
+	if (old_column == 120) DrawTraceColumn(120, 0, 0, 0);	// Axes as in InitCoordinate
+	trace_columns(260, 260, &lo, &hi);
+	if (old_column >= lo && old_column <= hi) DrawHorizontalLine(260, old_column, old_column, 0, 0, 0);
+	DrawTraceColumn(column, 0, 0, 31);
+}
+
+// Draws the trace point of 'sample' at 'x' (DrawEMG), unless it would cover a button
+static void DrawTracePoint(uint8_t sample, uint16_t x) {
+	uint16_t lo, hi;
+	uint16_t column = 239 - ((sample * 240UL) / 256);
+	if (column > 238) column = 238;
+	
+	uint16_t first = (x > 318) ? 318 : x;
+	
+	trace_columns(first, first + 2, &lo, &hi);
+	if (column >= lo && column + 2 <= hi) DrawEMG(sample, x);
+}
+
+// Runs in the Screen A loop after an SD failure: retries the mount with backoff (0.5 s doubling to 8 s).
+// An attempt without a card blocks for about 100 ms (CMD0 retries in SD_init), so the backoff keeps
+// the EMG processing mostly undisturbed. Full card / open errors are retried when logging is started again.
+// After a write error the recording has already been stopped and its file closed (RecordService). The card is
+// mounted again here, but the error stays shown until a new recording starts (begin_session clears it).
+static void SdRetry(void) {
+	if (sd_error != SD_FAIL_MOUNT && !(sd_error == SD_FAIL_WRITE && !fs_mounted)) return;
+	if (Timer_Millis() - sd_retry_from < sd_retry_ms) return;
+	
+	if (mount_sd() == FR_OK) {
+		if (sd_error == SD_FAIL_MOUNT) {
+			sd_error = 0;
+			DrawSdStatus();
+		}
+	} else {
+		sd_retry_ms   = (sd_retry_ms >= SD_RETRY_MAX_MS / 2) ? SD_RETRY_MAX_MS : sd_retry_ms * 2;
+		sd_retry_from = Timer_Millis();
+	}
+}
+/*************************************************************************************************************************/
+
+
+/************************************************ Recording: log EMG to SD ****************************************************/
+// Writes the window queued by queue_window() to the open log file (RMS value or every raw sample).
+// Called from RecordService(), after the window has been drawn: a write that has to wait for the card
+// does not delay the control decision or the trace.
+static void log_window(void) {
+	FRESULT res;
+	
+	if (!log_queued) return;
+	log_queued = 0;
+	
+	if (record_raw) {
+		Logger_NoteRms(log_rms_mv);
+#if RAW_RICE_CODING
+		res = Logger_WriteBlock(log_t_ms, rice_block, log_bytes, BUFFER_SIZE);
+#else
+		res = Logger_WriteRaw10(log_t_ms, rice_block, BUFFER_SIZE);
+#endif
+	} else {
+		res = log_rms_to_sd(log_t_ms, log_rms_mv);	// Log mV_RMS to SD card
+	}
+	if (res != FR_OK && log_res == FR_OK) {
+		log_res = res;								// Handled in RecordService (new log file)
+	}
+}
 
-	strcpy(filename_out, "EMG999.TXT");						// If no filename available, use EMG999.txt
+// Copies (raw samples: codes) the window in the ready buffer for log_window(), so the buffer can be handed back
+// to the ISR at once. Must be called before emg_buffer_full is cleared: the ISR does not write the ready buffer until then.
+static void queue_window(uint32_t rms_mv) {
+	log_window();		// Previous window not written yet (RecordService runs after every ScreenA, so normally nothing)
+	
+	log_t_ms   = emg_window_ms[emg_ready_buf];	// Not written by the ISR while emg_buffer_full is set
+	log_rms_mv = rms_mv;
+	if (record_raw) {
+#if RAW_RICE_CODING
+		log_bytes = Rice_EncodeBlock((const uint8_t *)emg_samples[emg_ready_buf], BUFFER_SIZE, rice_block);
+#else
+		memcpy(rice_block, (const uint8_t *)emg_samples[emg_ready_buf], PACK10_BYTES(BUFFER_SIZE));
+#endif
+	}
+	log_queued = 1;
 }
 
+// Runs in the main loop while recording, after ScreenA() has handled the latest window.
+// File operations that can block (new file after an error, rolling files) therefore start right after a
+// control decision, and the ADC double buffer gives them one window time before the next decision is due.
+static void RecordService(void) {
+	// Blink the recording indicator on the log button (once per second)
+	if (blink_flag) {
+		blink_flag = 0;
+		rec_blink = !rec_blink;
+		DrawLogButton();
+	}
+	
+	// Window of this pass, then the pending sector as soon as the card has finished the previous one
+	log_window();
+	if (log_res == FR_OK) {
+		log_res = Logger_Service();
+	}
+	
+	// Write error (card removed, card full, ...): continue in a new file or give up
+	if (log_res != FR_OK) {
+		if (!rotate_session()) {
+			StopRecording();
+			DrawScreenA();		// Shows the SD error
+		}
+		return;
+	}
+	
+	uint8_t shown_error = sd_error;
+	if (!SegmentService()) {	// Next file of a long recording
+		StopRecording();
+		DrawScreenA();
+	} else if (sd_error != shown_error) {
+		DrawSdStatus();			// Next file could not be prepared, or the switch cleared that error
+	}
+}
 
-// Logs a single RMS value (in millivolts) to the open SD file.
-// Must only be called after f_open(&file, ...) has succeeded.
-static void log_rms_to_sd(uint32_t rms_mv) {
-	char line[16];									// Buffer for holding text value of voltage
-	UINT bytes_written;								// Variable to store number of bytes actually written
-	uint8_t len = sprintf(line, "%lu\n", rms_mv);	// Format the RMS value followed by a newline, e.g., "1234\n"
-	f_write(&file, line, len, &bytes_written);		// Write the formatted string to the SD card file
+// Runs in the main loop while replaying: hands the next logged window to ScreenA() when it is due.
+// The window goes into the ready buffer, exactly as the ADC interrupt would hand it over.
+static void ReplayService(void) {
+	if (emg_buffer_full) return;		// Previous window not processed yet
+	
+	if (!replay_pending) {
+		if (!Replay_Next(&replay_t_ms, &replay_rms_mv, &replay_threshold, (uint8_t *)emg_samples[emg_ready_buf], rice_block)) {
+			StopReplay();				// End of the file: back to live input
+			DrawScreenA();
+			return;
+		}
+		replay_pending = 1;
+	}
+	if (!ReplayClock_Due(&replay_clock, replay_t_ms, Timer_Millis())) return;
+	
+	emg_window_ms[emg_ready_buf] = replay_t_ms;
+	if (replay_threshold != threshold) {	// Threshold change of the recording
+		uint16_t old_column = threshold_column();
+		threshold = replay_threshold;
+		MoveThresholdLine(old_column);
+	}
+	replay_pending  = 0;
+	emg_buffer_full = 1;
 }
 /*************************************************************************************************************************/
 
 
 /************************************************ Screen A: live EMG visualization ***********************************************/
-// Handles live EMG data processing, visualization, and motor/LED control
+// Handles EMG data processing (live ADC or replayed windows), motor/LED control, recording and visualization.
+// Per window the control decision comes first, then the window is logged (if recording) and then drawn,
+// so neither SD writes nor drawing delay the hand.
 void ScreenA(void) {
 	if (emg_buffer_full) {
-		emg_buffer_full = 0;	// Reset the buffer-full flag	
-		
-		// Calculate RMS from buffer
-		rms_adc = calculate_RMS();
-		
-		// Convert RMS to milivolts and scale by 4 (Gives better view on TFT)
-		rms_mv = ((uint32_t)rms_adc * VREF * 4) / 1023;
+		if (replay_speed && replay_rms) {
+			rms_mv = replay_rms_mv;		// Replay of an RMS log: the logged value (same scale as below)
+		} else {
+			// Calculate RMS from buffer
+			rms_adc = calculate_RMS();
+			
+			// Convert RMS to milivolts and scale by 4 (Gives better view on TFT)
+			rms_mv = ((uint32_t)rms_adc * VREF * RMS_SCALE) / 1023;
+		}
 		
 		//*** Send result over UART (FOR DEBUGGING) ***//
 		//itoa(rms_mv, buffer, 10);
@@ -208,21 +1061,6 @@ void ScreenA(void) {
 		//USART0_Transmit('\n');
 		/***********************************************/
 		
-		// Map EMG to screen size
-		uint16_t mapped_sample = ((rms_mv * 239UL) / 2000);
-		
-		// Draw EMG on screen at current x
-		DrawEMG(mapped_sample, x);
-		
-		// Move x for scrolling effect
-		x -= 3;
-		
-		// If x at end, reset to start of screen						
-		if (x <= 1) {
-			x = 319;			
-			InitCoordinate();	// Resets the screen
-		}
-		
 		// If RMS over threshold
 		if (rms_mv >= threshold) {
 			overThreshold++;			// Increment over threshold counter (helps smoothing)
@@ -242,34 +1080,27 @@ void ScreenA(void) {
 				overThreshold = 0;		// Reset counter
 			}
 		}
-	}
-}
-/*************************************************************************************************************************/
-
-
-/************************************************ Screen B: log EMG to SD & blink background ***********************************/
-// Logs EMG data and blinks screen
-void ScreenB(void) {
-	static uint8_t blink_state = 0;	// Keeps track of blinking
-
-	// Toggle background color when blink_flag is set (once per second)
-	if (blink_flag) {
-		blink_flag = 0;				// Reset flag
-		blink_state = !blink_state;	// Flip the state
 		
-		if (blink_state) {
-			BackgroundColor(31, 63, 31);	// Set background to white
-			} else {
-			BackgroundColor(0, 0, 0);		// Set background to black
+		// Queue the window for logging while the buffer is still ours (written by RecordService after drawing)
+		if (recording) {
+			queue_window(rms_mv);
+		}
+		emg_buffer_full = 0;	// Reset the buffer-full flag (buffer is free for the ISR again)
+		
+		// Map EMG to screen size
+		uint8_t mapped_sample = map_to_trace(rms_mv);
+		
+		// Draw EMG on screen at current x, over the erased previous pass
+		EraseTrace(x);
+		DrawTracePoint(mapped_sample, x);
+		
+		// Move x for scrolling effect
+		x -= 3;
+		
+		// If x at end, start again at the right edge (the old trace is erased strip by strip)
+		if (x <= 1) {
+			x = 319;
 		}
-	}
-
-	// If a new EMG buffer is full (from ISR)
-	if (emg_buffer_full) {
-		emg_buffer_full = 0;							// Reset flag
-		rms_adc = calculate_RMS();						// Calculate RMS
-		rms_mv = ((uint32_t)rms_adc * VREF * 4) / 1023;	// Convert RMS to militvolts 
-		log_rms_to_sd(rms_mv);							// Log mV_RMS to SD card
 	}
 }
 /*************************************************************************************************************************/
@@ -288,73 +1119,35 @@ int main(void) {
 	//DDRB |= (1 << PB7);		// LED pin (FOR DEBUGGING)
 
 	sei();							// Enable global timer interrupts
-	timer1_init();					// Start Timer1 for 1 Hz interrupts (for screenB)
+	timer1_init();					// Start Timer1 for 1 Hz interrupts (recording indicator)
+	Timer_Init();					// Start Timer3 1 ms system tick
 
-	current_state = STATE_SCREEN_A;	// Start in screen A (EMG visualization)
-	x = 319;						// Set initial X coordinate for plotting
+#ifdef SD_BENCHMARK
+	USART0_Init(MYUBRR);			// Benchmark results are printed over UART
+	SD_Bench_Run();					// Measure SD read/write throughput before normal operation
+#endif
 
-	InitCoordinate();				// Draw Screen A axes once at startup
+	mount_sd();						// Mount the SD card once at boot (if no card is inserted, it is mounted when logging starts)
 
-	for (;;) {
-		switch (current_state) {
+	x = 319;						// Set initial X coordinate for plotting
 
-			case STATE_SCREEN_A:
-			// Continuously run Screen A (live view) until a touch is detected
-			while ( READ(D_IRQ_PINR, D_IRQ_PIN) ) {
-				ScreenA();
-			}
-			
-			// Touch detected: debounce + wait for lift
-			_delay_ms(50);
-			while ( !READ(D_IRQ_PINR, D_IRQ_PIN) );
-			_delay_ms(50);
+	DrawScreenA();					// Draw Screen A axes and buttons once at startup
 
-			// Switch to Screen B (logging mode)
-			current_state = STATE_SCREEN_B;
-			
-			// Initialize Screen B background immediately to black
-			BackgroundColor(0, 0, 0);
-			break;
-
-			case STATE_SCREEN_B: {
-				// Try to mount the SD card file system
-				if (f_mount(&fs, "", 1) != FR_OK) {
-					// Mount failed: enter infinite loop (system halt)
-					while (1) { }
-				}
-
-				// Generate new unique filename on SD-card
-				char fname[16];
-				get_new_filename(fname);
-
-				// Try to open/create the file for writing (overwrite if it exists)
-				if (f_open(&file, fname, FA_WRITE | FA_CREATE_ALWAYS) != FR_OK) {
-					// File open failed: halt
-					while (1) { }
-				}
-				
-				// Mounted the SD card file system and found unique file name, now ScreenB can run continuously.
-				// Run Screen B logic (logging + background blinking) until touch
-				while ( READ(D_IRQ_PINR, D_IRQ_PIN) ) {
-					ScreenB();
-				}
-
-				// Touch detected: close file and return to Screen A
-				f_close(&file);
-				
-				// Debounce touch
-				_delay_ms(50);
-				while ( !READ(D_IRQ_PINR, D_IRQ_PIN) );
-				_delay_ms(50);
-				
-				// Reinitialize for Screen A view
-				current_state = STATE_SCREEN_A;
-				InitCoordinate();		// Redraw axis
-				x = 319;				// Reset x position for plotting
-				overThreshold  = 0;		// Reset flag
-				underThreshold = 0;		// Reset flag
-				break;
+	for (;;) {
+		// Live view and motor control run continuously; a started recording runs alongside them.
+		// Only a touch interrupts the loop (HandleTouch waits until the finger is lifted)
+		while ( READ(D_IRQ_PINR, D_IRQ_PIN) ) {
+			ScreenA();
+			if (recording) {
+				RecordService();	// Write errors, rolling files, blinking indicator
+			} else if (replay_speed) {
+				ReplayService();	// Feeds logged windows instead of the ADC
+			} else {
+				SdRetry();		// Mount the card again after a failure (with backoff)
 			}
 		}
+		
+		// Touch detected: dispatch to the touched button (waits for lift + debounce)
+		HandleTouch(screen_a_buttons, BUTTON_COUNT(screen_a_buttons));
 	}
 }